@@ -0,0 +1,36 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "cpu.h"
+#include "jit.h"
+
+/* bumped whenever the layout below or the contract of the
+ * code changes, translated code of another version is
+ * refused */
+#define AOT_VERSION 2
+
+/* a straight-line run translated ahead of time, its code
+ * has the contract of jit_code_t and is used only while
+ * memory still holds the instructions it was made from */
+typedef struct {
+  vaddr_t pc;
+  uint32_t len;
+  const uint32_t *code;
+  jit_code_t fn;
+} aot_run_t;
+
+/* handed to the translated code when it is loaded */
+typedef struct {
+  uint32_t *gpr, *hi, *lo, *pc;
+  bool *has_exception;
+  uint32_t (*load)(vaddr_t addr, int kind);
+  void (*store)(vaddr_t addr, uint32_t data, int len);
+} aot_runtime_t;
+
+/* write the executable segments of elf_file as C */
+void aot_translate(const char *elf_file, const char *c_file);
+/* load the shared object built from such C */
+void aot_load(const char *so_file);
+const aot_run_t *aot_lookup(vaddr_t pc);
+
+#endif
@@ -35,6 +35,11 @@
 
 #define CP0_PRID_SEL 0  // sel = 0
 #define CP0_EBASE_SEL 1 // sel = 1
+#define CP0_PWBASE_SEL 5  // reg = CP0_PAGEMASK
+#define CP0_PWFIELD_SEL 6 // reg = CP0_PAGEMASK
+#define CP0_PWSIZE_SEL 7  // reg = CP0_PAGEMASK
+#define CP0_PWCTL_SEL 6   // reg = CP0_WIRED
+#define CP0_INTCTL_SEL 1  // reg = CP0_STATUS
 
 #define CP0_TAG_LO 28
 #define CP0_TAG_HI 29
@@ -99,7 +104,7 @@ typedef struct {
 
   uint32_t __ : 4;
   uint32_t CE : 2;
-  uint32_t __ : 1;
+  uint32_t TI : 1; // release 2
   uint32_t BD : 1;
 } cp0_cause_t;
 
@@ -198,8 +203,39 @@ typedef struct {
 
 typedef uint32_t cp0_wired_t;
 
-#define TLB_BITS 5
-#define NR_TLB_ENTRY (1 << TLB_BITS)
+/* page table walker, index shifts and widths of each level */
+typedef struct {
+  uint32_t PTEI : 6; /* pte >> PTEI is the EntryLo */
+  uint32_t PTI : 6;
+  uint32_t MDI : 6;
+  uint32_t UDI : 6;
+  uint32_t GDI : 6;
+  uint32_t __ : 2;
+} cp0_pwfield_t;
+
+typedef struct {
+  uint32_t PTEW : 6; /* a pte is 4 << PTEW bytes */
+  uint32_t PTW : 6;
+  uint32_t MDW : 6;
+  uint32_t UDW : 6;
+  uint32_t GDW : 6;
+  uint32_t PS : 1; /* 64-bit directory pointers */
+  uint32_t __ : 1;
+} cp0_pwsize_t;
+
+typedef struct {
+  uint32_t Psn : 6;
+  uint32_t HugePg : 1;
+  uint32_t __ : 24;
+  uint32_t PWEn : 1;
+} cp0_pwctl_t;
+
+#define TLB_BITS 6
+#if CONFIG_TLB_ENTRIES
+#  define NR_TLB_ENTRY CONFIG_TLB_ENTRIES
+#else
+#  define NR_TLB_ENTRY (1 << TLB_BITS)
+#endif
 
 typedef struct {
   uint32_t __ : 4;
@@ -223,8 +259,12 @@ typedef union {
 	struct { cp0_entry_lo_t entry_lo0;  uint32_t __[7]; };
 	struct { cp0_entry_lo_t entry_lo1;  uint32_t __[7]; };
 	struct { cp0_context_t context;     uint32_t __[7]; };
-	struct { cp0_pagemask_t pagemask;   uint32_t __[7]; };
-	struct { cp0_wired_t wired;         uint32_t __[7]; };
+	struct { cp0_pagemask_t pagemask;   uint32_t __[4];
+	         vaddr_t pwbase;
+	         cp0_pwfield_t pwfield;
+	         cp0_pwsize_t pwsize; };
+	struct { cp0_wired_t wired;         uint32_t __[5];
+	         cp0_pwctl_t pwctl;         uint32_t __[1]; };
 	uint32_t reserved[8];                 /* reserved */
 	struct { uint32_t badvaddr;         uint32_t __[7]; };
 	struct { uint32_t count[2];         uint32_t __[6]; };
@@ -270,6 +310,22 @@ typedef struct {
   bool is_delayslot;
 #endif
   bool has_exception;
+
+  /* ll/sc reservation, sc stores only while llbit is set and
+   * the word at lladdr still holds llval */
+  bool llbit;
+  paddr_t lladdr;
+  uint32_t llval;
+
+#if CONFIG_FPU
+  /* Status.FR is 0, a double lives in an even/odd pair */
+  union {
+    uint32_t w[32];
+    float s[32];
+    double d[16];
+  } fpr;
+  uint32_t fcsr;
+#endif
 #if CONFIG_DUMP_SYSCALL
   bool is_syscall;
 #endif
@@ -291,6 +347,7 @@ typedef struct {
 #define EXC_CPU 11    /* ????? */
 #define EXC_OV 12     /* arithmetic overflow */
 #define EXC_TRAP 13   /* trap */
+#define EXC_FPE 15    /* floating point */
 
 #define EX_EJTAG_DEBUG 1
 #define EX_RESET 2
@@ -315,6 +372,17 @@ typedef struct {
 
 #define MAKE_EX(EX, CODE) (((EX) << 16) | CODE)
 
+/* cp1 control registers */
+#define FPU_FIR 0
+#define FPU_FCSR 31
+
+#define FCSR_RM 0x3
+#define FCSR_FLAGS_SHIFT 2
+#define FCSR_ENABLES_SHIFT 7
+#define FCSR_CAUSE_SHIFT 12
+#define FCSR_E 0x20000   /* cause: unimplemented operation */
+#define FCSR_MASK 0xFF83FFFF
+
 typedef struct {
   union {
     uint32_t val;
@@ -337,8 +405,34 @@ typedef struct {
   };
 } Inst; // Instruction
 
-extern CPU_state cpu;
+#if CONFIG_SMP
+/* state every vcpu has its own copy of, each vcpu runs on
+ * its own host thread */
+#  define __percpu __thread
+#else
+#  define __percpu
+#endif
+
+extern __percpu CPU_state cpu;
 int init_cpu(vaddr_t entry);
 void nemu_set_irq(int irqno, bool val);
 
+/* the vcpu of the calling thread, EBase.CPUNum */
+static inline int cpu_current_id() { return cpu.cp0.ebase & 0x3FF; }
+
+#if CONFIG_SMP
+/* drive an irq line of one vcpu, nemu_set_irq drives
+ * those of vcpu 0 */
+void nemu_set_cpu_irq(int cpu_id, int irqno, bool val);
+/* start a vcpu held in reset at pc, with arg in $a0 */
+void cpu_start(int cpu_id, vaddr_t pc, uint32_t arg);
+#endif
+uint64_t mips_get_count();
+/* make the cpu leave straight-line execution and look at
+ * timers, interrupts and nemu_state */
+void cpu_kick();
+/* switch to the fast, trace, profile or check build of
+ * cpu_exec, false if there is no such one */
+bool cpu_set_exec_variant(const char *name);
+
 #endif
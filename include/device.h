@@ -23,6 +23,7 @@ static inline void check_aligned_ioaddr(
 
 void *vaddr_map(vaddr_t vaddr, uint32_t size);
 void load_rom(uint32_t entry);
+void load_rom_args(uint32_t entry, const uint32_t args[4]);
 
 typedef struct device_t {
   const int type;
@@ -42,13 +43,29 @@ typedef struct device_t {
   void (*set_block_data)(uint32_t addr, const void *data, int len);
 } device_t;
 
-static inline uint32_t mr_index(uint32_t addr) { return addr / (4 * 1024); }
+/* guest ram is tried first, then the device found last by
+ * this vcpu, then a search of the sorted device table */
+extern device_t *guest_ram_device;
+extern __percpu device_t *last_device;
+device_t *find_device_slow(paddr_t addr);
+
+static inline bool device_contains(device_t *dev, paddr_t addr) {
+  return dev && addr - dev->start < dev->size;
+}
 
 static inline device_t *find_device(paddr_t addr) {
-  extern device_t *memory_regions[1024 * 1024];
-  return memory_regions[mr_index(ioremap(addr))];
+  addr = ioremap(addr);
+  if (device_contains(guest_ram_device, addr)) return guest_ram_device;
+  if (device_contains(last_device, addr)) return last_device;
+  return find_device_slow(addr);
 }
 
+/* lazily zeroed host memory backing a guest ram device */
+void *guest_ram_alloc(device_t *dev);
+/* some guest ram is in explicit huge pages */
+extern bool guest_ram_hugetlb;
+void ddr_set_size(uint32_t size);
+
 #  define SCR_W 400
 #  define SCR_H 300
 #  define WINDOW_W (SCR_W * 2)
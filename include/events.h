@@ -24,4 +24,21 @@ typedef struct event_t {
 void event_bind_handler(int event_type, event_handler_t handler);
 int notify_event(int event_type, void *data, int len);
 
+/* timed events, kept in a min-heap on their deadline in
+ * Count ticks and run by the cpu between instructions */
+typedef void (*nemu_timer_cb_t)(void *opaque);
+
+typedef struct nemu_timer_t {
+  uint64_t deadline;
+  nemu_timer_cb_t cb;
+  void *opaque;
+  int slot; /* index in the heap, -1 if not armed */
+} nemu_timer_t;
+
+void nemu_timer_init(nemu_timer_t *timer, nemu_timer_cb_t cb, void *opaque);
+void nemu_timer_mod(nemu_timer_t *timer, uint64_t deadline);
+void nemu_timer_del(nemu_timer_t *timer);
+uint64_t nemu_timer_deadline(); /* the earliest one, -1 if none */
+void nemu_timer_run(uint64_t now);
+
 #endif
@@ -0,0 +1,28 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "cpu.h"
+
+/* compiled code is entered with cpu.pc at its first
+ * instruction and returns the number of retired ones,
+ * if it stops early cpu.has_exception is set and cpu.pc
+ * points to the faulting instruction */
+typedef uint32_t (*jit_code_t)(void);
+
+#define JIT_HOT_THRESHOLD 64
+
+/* kind of jit_vaddr_load */
+#define JIT_LOAD_LEN_MASK 0x7
+#define JIT_LOAD_SIGNED 0x8
+
+bool jit_supported(Inst inst);
+/* kind of lb, lh, lw, lbu and lhu */
+int jit_load_kind(Inst inst);
+jit_code_t jit_compile(const Inst *code, int n);
+void jit_reset();
+
+/* provided by cpu.c for compiled code */
+uint32_t jit_vaddr_load(vaddr_t addr, int kind);
+void jit_vaddr_store(vaddr_t addr, uint32_t data, int len);
+
+#endif
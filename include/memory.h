@@ -55,6 +55,9 @@ uint32_t paddr_peek(paddr_t, int);
 uint32_t dbg_vaddr_read(vaddr_t, int);
 void dbg_vaddr_write(vaddr_t addr, int len, uint32_t data);
 
+/* drop decoded instructions of the physical pages written */
+void invalidate_decode_range(paddr_t addr, uint32_t len);
+
 static inline vaddr_t ioremap(vaddr_t vaddr) { return vaddr & 0x1FFFFFFF; }
 
 enum { MMU_LOAD, MMU_STORE };
@@ -66,11 +69,15 @@ static inline vaddr_t prot_addr_with_attr(vaddr_t addr, mmu_attr_t *attr) {
   switch ((addr >> 29) & 0x7) {
   case 4: /* kseg0 */
   case 5: /* kseg1 */
+    attr->pgshift = 29;
+    attr->dirty = 1;
     return ioremap(addr);
   case 7: /* kseg3 */
     panic("%08x: addr %08x is invalid\n", cpu.pc, addr);
   case 6: /* supervisor */
     if (!CONFIG_IS_ENABLED(PAGING)) {
+      attr->pgshift = 29;
+      attr->dirty = 1;
       return addr;
     } else {
       vaddr_t paddr = page_translate(addr, attr);
@@ -78,6 +85,8 @@ static inline vaddr_t prot_addr_with_attr(vaddr_t addr, mmu_attr_t *attr) {
     }
   case 0 ... 3: /* kuseg */
     if (!CONFIG_IS_ENABLED(PAGING) || cpu.cp0.status.ERL) {
+      attr->pgshift = 31;
+      attr->dirty = 1;
       return addr;
     } else {
       vaddr_t paddr = page_translate(addr, attr);
@@ -26,9 +26,12 @@ typedef struct {
   tlb_phyn_t p1;
 } tlb_entry_t;
 
+void tlb_init();
 void tlb_present();
 void tlb_read(uint32_t i);
 void tlb_write(uint32_t i);
+/* drop what the soft tlbs cached from tlb[i] */
+void invalidate_tlb_entry(uint32_t i);
 
 typedef struct {
   /* as argument */
@@ -37,6 +40,7 @@ typedef struct {
   /* as return value */
   uint32_t dirty : 1;
   uint32_t miss  : 1;
+  uint32_t pgshift : 5; /* log2 of the mapping size */
 } mmu_attr_t;
 
 vaddr_t page_translate(vaddr_t, mmu_attr_t *attr);
@@ -0,0 +1,30 @@
+#ifndef SHARED_RAM_H
+#define SHARED_RAM_H
+
+#include <stdint.h>
+
+/* layout of the shm object made by --shared-ram=NAME, which
+ * a co-simulation process maps from /dev/shm/NAME to see
+ * guest ram while nemu runs, without copies */
+#define SHARED_RAM_MAGIC 0x554d454e /* "NEMU" */
+#define SHARED_RAM_VERSION 1
+#define SHARED_RAM_MAX_REGIONS 8
+
+typedef struct {
+  char name[16];   /* device name, like "ddr" */
+  uint32_t paddr;  /* guest physical start */
+  uint32_t size;   /* bytes */
+  uint64_t offset; /* of the contents in the object */
+} shared_ram_region_t;
+
+/* the first page of the object, a region is complete once
+ * it is counted in nr_regions */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nr_regions;
+  uint32_t __pad;
+  shared_ram_region_t regions[SHARED_RAM_MAX_REGIONS];
+} shared_ram_header_t;
+
+#endif
@@ -10,8 +10,16 @@
 #include <netinet/ether.h>
 
 /* file */
+typedef struct {
+  const void *p;
+  size_t size;
+  int fd; /* kept open for copy-on-write mappings */
+} mapped_file_t;
+
 size_t get_file_size(const char *img_file);
 void *read_file(const char *filename);
+/* read-only and never unmapped, NULL if empty or missing */
+const mapped_file_t *map_file(const char *filename);
 ssize_t write_s(int fd, const void *buf, size_t count);
 
 /* tap */
@@ -0,0 +1,393 @@
+#if CONFIG_AOT
+
+#  include <dlfcn.h>
+#  include <elf.h>
+#  include <stdio.h>
+#  include <stdlib.h>
+
+#  include "aot.h"
+#  include "common.h"
+#  include "utils.h"
+
+/* The executable segments of a bare-metal elf are written
+ * out as C, one function per known entry point, running to
+ * the end of the straight-line run it starts. Entry points
+ * are the elf entry, targets and fall-throughs of direct
+ * branches and return addresses of calls, anything else,
+ * e.g. an indirect jump elsewhere, is interpreted until it
+ * reaches one.
+ *
+ * The C is built into a shared object once and loaded with
+ * --aot, the decode cache then puts a run in place of the
+ * instruction it starts, see aot_install() in cpu.c.
+ */
+
+/* what the translated code sees of aot.h */
+static const char aot_prologue[] =
+    "/* translated by nemu from %s, build with\n"
+    " *   cc -O2 -shared -fPIC -o FILE.so FILE.c\n"
+    " * and run it with --aot=FILE.so */\n"
+    "#include <stdbool.h>\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "typedef uint32_t (*aot_code_t)(void);\n"
+    "\n"
+    "typedef struct {\n"
+    "  uint32_t pc;\n"
+    "  uint32_t len;\n"
+    "  const uint32_t *code;\n"
+    "  aot_code_t fn;\n"
+    "} aot_run_t;\n"
+    "\n"
+    "typedef struct {\n"
+    "  uint32_t *gpr, *hi, *lo, *pc;\n"
+    "  bool *has_exception;\n"
+    "  uint32_t (*load)(uint32_t addr, int kind);\n"
+    "  void (*store)(uint32_t addr, uint32_t data, int len);\n"
+    "} aot_runtime_t;\n"
+    "\n"
+    "static aot_runtime_t rt;\n"
+    "\n"
+    "const uint32_t aot_version = %d;\n"
+    "\n"
+    "void aot_bind(const aot_runtime_t *r) { rt = *r; }\n";
+
+/* $0 reads as a constant */
+static const char *reg(char *buf, int r) {
+  if (r == 0) return "0u";
+  sprintf(buf, "r[%d]", r);
+  return buf;
+}
+
+static void emit_special(FILE *fp, Inst inst) {
+  static const char *alu[64] = {
+      [0x21] = "+",
+      [0x23] = "-",
+      [0x24] = "&",
+      [0x25] = "|",
+      [0x26] = "^",
+  };
+  char bs[16], bt[16];
+  const char *rs = reg(bs, inst.rs), *rt = reg(bt, inst.rt);
+  int rd = inst.rd;
+
+  switch (inst.func) {
+  case 0x10: /* mfhi */
+  case 0x12: /* mflo */
+    if (rd == 0) return;
+    fprintf(fp, "  r[%d] = *rt.%s;\n", rd, inst.func == 0x10 ? "hi" : "lo");
+    return;
+  case 0x11: /* mthi */
+  case 0x13: /* mtlo */
+    fprintf(fp, "  *rt.%s = %s;\n", inst.func == 0x11 ? "hi" : "lo", rs);
+    return;
+  case 0x18: /* mult */
+  case 0x19: /* multu */
+    if (inst.func == 0x18)
+      fprintf(fp, "  p = (int64_t)(int32_t)%s * (int32_t)%s;\n", rs, rt);
+    else
+      fprintf(fp, "  p = (uint64_t)%s * %s;\n", rs, rt);
+    fprintf(fp, "  *rt.lo = p;\n  *rt.hi = p >> 32;\n");
+    return;
+  }
+
+  if (rd == 0) return;
+  switch (inst.func) {
+  case 0x00: fprintf(fp, "  r[%d] = %s << %d;\n", rd, rt, inst.shamt); break;
+  case 0x02:
+    if (inst.rs) /* rotr */
+      fprintf(fp, "  r[%d] = %s >> %d | %s << %d;\n", rd, rt, inst.shamt, rt,
+          (32 - inst.shamt) & 31);
+    else
+      fprintf(fp, "  r[%d] = %s >> %d;\n", rd, rt, inst.shamt);
+    break;
+  case 0x03:
+    fprintf(fp, "  r[%d] = (int32_t)%s >> %d;\n", rd, rt, inst.shamt);
+    break;
+  case 0x04: fprintf(fp, "  r[%d] = %s << (%s & 31);\n", rd, rt, rs); break;
+  case 0x06:
+    if (inst.shamt) /* rotrv */
+      fprintf(fp, "  r[%d] = %s >> (%s & 31) | %s << (-%s & 31);\n", rd, rt,
+          rs, rt, rs);
+    else
+      fprintf(fp, "  r[%d] = %s >> (%s & 31);\n", rd, rt, rs);
+    break;
+  case 0x07:
+    fprintf(fp, "  r[%d] = (int32_t)%s >> (%s & 31);\n", rd, rt, rs);
+    break;
+  case 0x0a: fprintf(fp, "  if (%s == 0) r[%d] = %s;\n", rt, rd, rs); break;
+  case 0x0b: fprintf(fp, "  if (%s != 0) r[%d] = %s;\n", rt, rd, rs); break;
+  case 0x27: fprintf(fp, "  r[%d] = ~(%s | %s);\n", rd, rs, rt); break;
+  case 0x2a:
+    fprintf(fp, "  r[%d] = (int32_t)%s < (int32_t)%s;\n", rd, rs, rt);
+    break;
+  case 0x2b: fprintf(fp, "  r[%d] = %s < %s;\n", rd, rs, rt); break;
+  default:
+    fprintf(fp, "  r[%d] = %s %s %s;\n", rd, rs, alu[inst.func], rt);
+    break;
+  }
+}
+
+/* a function is entered with cpu.pc at its first instruction,
+ * as a physical page may be mapped at several addresses it
+ * is only ever advanced, *pc_k is the instruction it is at */
+static void emit_pc(FILE *fp, int k, int *pc_k) {
+  if (k != *pc_k) fprintf(fp, "  *rt.pc += %d;\n", (k - *pc_k) << 2);
+  *pc_k = k;
+}
+
+/* instruction k of the function, cpu.pc is set before a
+ * memory access so that an exception sees the right epc */
+static void emit_inst(FILE *fp, Inst inst, int k, int *pc_k) {
+  char bs[16], bt[16];
+  const char *rs = reg(bs, inst.rs), *rt = reg(bt, inst.rt);
+  int t = inst.rt;
+
+  switch (inst.op) {
+  case 0x00: emit_special(fp, inst); return;
+  case 0x09: /* addiu */
+    if (t) fprintf(fp, "  r[%d] = %s + 0x%xu;\n", t, rs, (int32_t)inst.simm);
+    return;
+  case 0x0a: /* slti */
+    if (t) fprintf(fp, "  r[%d] = (int32_t)%s < %d;\n", t, rs, inst.simm);
+    return;
+  case 0x0b: /* sltiu */
+    if (t) fprintf(fp, "  r[%d] = %s < 0x%xu;\n", t, rs, (int32_t)inst.simm);
+    return;
+  case 0x0c: /* andi */
+  case 0x0d: /* ori */
+  case 0x0e: /* xori */
+    if (t)
+      fprintf(fp, "  r[%d] = %s %s 0x%xu;\n", t, rs,
+          inst.op == 0x0c ? "&" : inst.op == 0x0d ? "|" : "^", inst.uimm);
+    return;
+  case 0x0f: /* lui */
+    if (t) fprintf(fp, "  r[%d] = 0x%xu;\n", t, inst.uimm << 16);
+    return;
+  case 0x1c: /* mul */
+    if (inst.rd) fprintf(fp, "  r[%d] = %s * %s;\n", inst.rd, rs, rt);
+    return;
+  case 0x1f: /* seb, seh, ext */
+    if (inst.func == 0x00) {
+      if (t)
+        fprintf(fp, "  r[%d] = %s >> %d & 0x%xu;\n", t, rs, inst.shamt,
+            0xFFFFFFFFu >> (31 - inst.rd));
+      return;
+    }
+    if (inst.rd)
+      fprintf(fp, "  r[%d] = (int32_t)(%s)%s;\n", inst.rd,
+          inst.shamt == 0x10 ? "int8_t" : "int16_t", rt);
+    return;
+  case 0x20: /* lb */
+  case 0x21: /* lh */
+  case 0x23: /* lw */
+  case 0x24: /* lbu */
+  case 0x25: /* lhu */ {
+    emit_pc(fp, k, pc_k);
+    fprintf(fp, "  v = rt.load(%s + 0x%xu, %d);\n", rs, (int32_t)inst.simm,
+        jit_load_kind(inst));
+    fprintf(fp, "  if (*rt.has_exception) return %d;\n", k);
+    if (t) fprintf(fp, "  r[%d] = v;\n", t);
+    return;
+  }
+  case 0x28: /* sb */
+  case 0x29: /* sh */
+  case 0x2b: /* sw */
+    emit_pc(fp, k, pc_k);
+    fprintf(fp, "  rt.store(%s + 0x%xu, %s, %d);\n", rs, (int32_t)inst.simm,
+        rt, inst.op == 0x28 ? 1 : inst.op == 0x29 ? 2 : 4);
+    fprintf(fp, "  if (*rt.has_exception) return %d;\n", k);
+    return;
+  default: panic("instruction %08x can not be translated\n", inst.val);
+  }
+}
+
+/* code[0, n) runs from pc, entry marks where control may
+ * arrive other than by falling through */
+static void mark_entries(
+    const uint32_t *code, uint32_t n, vaddr_t pc, vaddr_t base, bool *entry,
+    uint32_t nentry) {
+  for (uint32_t i = 0; i < n; i++, pc += 4) {
+    Inst inst = {.val = code[i]};
+    vaddr_t targets[2] = {pc + 8, pc + 8};
+    switch (inst.op) {
+    case 0x00: /* jr, jalr */
+      if (inst.func != 0x08 && inst.func != 0x09) continue;
+      break;
+    case 0x01: /* bltz, bgez, bltzal... */
+      if ((inst.rt & 0xc) != 0) continue;
+      targets[0] = pc + 4 + (inst.simm << 2);
+      break;
+    case 0x02: /* j, jal */
+    case 0x03:
+      targets[0] = ((pc + 4) & 0xf0000000) | (inst.addr << 2);
+      break;
+    case 0x04 ... 0x07: /* beq, bne, blez, bgtz */
+    case 0x14 ... 0x17: /* beql, bnel, blezl, bgtzl */
+      targets[0] = pc + 4 + (inst.simm << 2);
+      break;
+    default: continue;
+    }
+
+    for (int j = 0; j < 2; j++) {
+      uint32_t idx = (targets[j] - base) >> 2;
+      if ((targets[j] & 3) == 0 && idx < nentry) entry[idx] = true;
+    }
+  }
+}
+
+/* one function per entry of code[0, n), each ends by
+ * calling the one of the next entry in the same run */
+static int emit_runs(FILE *fp, const uint32_t *code, uint32_t n, vaddr_t pc,
+    const bool *entry, int seg, FILE *table) {
+  int nruns = 0;
+  for (uint32_t s = 0; s < n;) {
+    /* a run never crosses a page, see decode_page_t */
+    uint32_t e = s;
+    while (e < n && jit_supported((Inst){.val = code[e]}) &&
+           (e == s || ((pc + (e << 2)) & 0xFFF) != 0))
+      e++;
+    /* a single instruction is not worth the call */
+    if (e - s < 2) {
+      s = e > s ? e : s + 1;
+      continue;
+    }
+
+    /* entries of [s, e), translated from the last one so
+     * that each function can call its successor */
+    uint32_t next = e;
+    for (uint32_t i = e; i-- > s;) {
+      if (i != s && !entry[i]) continue;
+
+      vaddr_t start = pc + (i << 2);
+      fprintf(fp, "\nstatic uint32_t run_%08x(void) {\n", start);
+      fprintf(fp, "  uint32_t *r = rt.gpr, v;\n  uint64_t p;\n");
+      fprintf(fp, "  (void)r, (void)v, (void)p;\n");
+      int pc_k = 0;
+      for (uint32_t j = i; j < next; j++)
+        emit_inst(fp, (Inst){.val = code[j]}, j - i, &pc_k);
+      if (next < e) {
+        emit_pc(fp, next - i, &pc_k);
+        fprintf(fp, "  return %d + run_%08x();\n}\n", next - i,
+            pc + (next << 2));
+      } else
+        fprintf(fp, "  return %d;\n}\n", next - i);
+
+      if (e - i >= 2) {
+        fprintf(table, "    {0x%08x, %d, &seg%d[%d], run_%08x},\n", start,
+            e - i, seg, i, start);
+        nruns++;
+      }
+      next = i;
+    }
+    s = e;
+  }
+  return nruns;
+}
+
+void aot_translate(const char *elf_file, const char *c_file) {
+  Assert(elf_file, "Need an elf file");
+  const mapped_file_t *file = map_file(elf_file);
+  Assert(file, "elf file '%s' cannot be opened for read\n", elf_file);
+  const uint8_t *buf = file->p;
+  Elf32_Ehdr *elf = (void *)buf;
+  Assert(memcmp(elf->e_ident, ELFMAG, SELFMAG) == 0, "%s is not an elf\n",
+      elf_file);
+
+  FILE *fp = fopen(c_file, "w");
+  Assert(fp, "can not open '%s' for write\n", c_file);
+  /* the table goes to the end of the file */
+  FILE *table = tmpfile();
+  assert(table);
+
+  fprintf(fp, aot_prologue, elf_file, AOT_VERSION);
+
+  int nruns = 0;
+  for (int i = 0; i < elf->e_phnum; i++) {
+    Elf32_Phdr *ph = (void *)(buf + elf->e_phoff + i * elf->e_phentsize);
+    if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+
+    const uint32_t *code = (void *)(buf + ph->p_offset);
+    uint32_t n = ph->p_filesz >> 2;
+    fprintf(fp, "\nstatic const uint32_t seg%d[] = {", i);
+    for (uint32_t j = 0; j < n; j++)
+      fprintf(fp, "%s0x%08x,", j % 6 ? " " : "\n    ", code[j]);
+    fprintf(fp, "\n};\n");
+
+    bool *entry = calloc(n, sizeof(bool));
+    for (int j = 0; j < elf->e_phnum; j++) {
+      Elf32_Phdr *other = (void *)(buf + elf->e_phoff + j * elf->e_phentsize);
+      if (other->p_type != PT_LOAD || !(other->p_flags & PF_X)) continue;
+      mark_entries((void *)(buf + other->p_offset), other->p_filesz >> 2,
+          other->p_vaddr, ph->p_vaddr, entry, n);
+    }
+    if (elf->e_entry - ph->p_vaddr < n << 2)
+      entry[(elf->e_entry - ph->p_vaddr) >> 2] = true;
+
+    nruns += emit_runs(fp, code, n, ph->p_vaddr, entry, i, table);
+    free(entry);
+  }
+
+  fprintf(fp, "\nconst aot_run_t aot_runs[] = {\n");
+  rewind(table);
+  for (int c; (c = fgetc(table)) != EOF;) fputc(c, fp);
+  fprintf(fp, "};\n\nconst uint32_t aot_nr_runs = %d;\n", nruns);
+
+  fclose(table);
+  fclose(fp);
+  Log("%d runs of %s translated to %s\n", nruns, elf_file, c_file);
+}
+
+static aot_run_t *aot_runs = NULL;
+static uint32_t aot_nr_runs = 0;
+
+static int aot_run_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const aot_run_t *)a)->pc, y = ((const aot_run_t *)b)->pc;
+  return x < y ? -1 : x > y;
+}
+
+void aot_load(const char *so_file) {
+  void *handle = dlopen(so_file, RTLD_NOW | RTLD_LOCAL);
+  Assert(handle, "%s\n", dlerror());
+
+  const uint32_t *version = dlsym(handle, "aot_version");
+  const aot_run_t *runs = dlsym(handle, "aot_runs");
+  const uint32_t *nr_runs = dlsym(handle, "aot_nr_runs");
+  void (*bind)(const aot_runtime_t *) = dlsym(handle, "aot_bind");
+  Assert(version && runs && nr_runs && bind, "%s is not translated code\n",
+      so_file);
+  Assert(*version == AOT_VERSION, "%s is of version %d, expect %d\n",
+      so_file, *version, AOT_VERSION);
+
+  aot_runtime_t rt = {
+      .gpr = cpu.gpr,
+      .hi = &cpu.hi,
+      .lo = &cpu.lo,
+      .pc = &cpu.pc,
+      .has_exception = &cpu.has_exception,
+      .load = jit_vaddr_load,
+      .store = jit_vaddr_store,
+  };
+  bind(&rt);
+
+  /* looked up by pc when an instruction is decoded */
+  aot_nr_runs = *nr_runs;
+  aot_runs = malloc(sizeof(aot_run_t) * aot_nr_runs);
+  memcpy(aot_runs, runs, sizeof(aot_run_t) * aot_nr_runs);
+  qsort(aot_runs, aot_nr_runs, sizeof(aot_run_t), aot_run_cmp);
+}
+
+const aot_run_t *aot_lookup(vaddr_t pc) {
+  uint32_t lo = 0, hi = aot_nr_runs;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (aot_runs[mid].pc == pc) return &aot_runs[mid];
+    if (aot_runs[mid].pc < pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include <elf.h>
+#include <fenv.h>
+#include <math.h>
 #include <pthread.h>
 #include <setjmp.h>
 #include <sys/resource.h>
@@ -8,8 +10,11 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "aot.h"
 #include "debug.h"
 #include "device.h"
+#include "events.h"
+#include "jit.h"
 #include "memory.h"
 #include "mmu.h"
 #include "monitor.h"
@@ -19,10 +24,18 @@
 
 /* some global bariables */
 nemu_state_t nemu_state = NEMU_STOP;
-CPU_state cpu;
+__percpu CPU_state cpu;
 
 static uint64_t nemu_start_time = 0;
 
+#if CONFIG_VIRTUAL_TIME || CONFIG_POLL_SKIP
+/* retired instructions, the clock of virtual time and
+ * of the polling loop detector */
+static __percpu uint64_t nemu_icount = 0;
+#endif
+
+uint64_t mips_get_count();
+
 /* clang-format off */
 const char *regs[32] = {
   "0 ", "at", "v0", "v1",
@@ -41,22 +54,153 @@ const char *regs[32] = {
 
 #define MAX_INSTR_TO_PRINT 10
 
-void nemu_set_irq(int irqno, bool val) {
-  static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+/* debug code of cpu_exec, a copy of cpu_exec is built for
+ * a fixed set of these and the helpers it inlines take the
+ * set as an argument, so the others fold away */
+#define EXEC_INSTR_LOG 0x01
+#define EXEC_FUNCTION_TRACE 0x02
+#define EXEC_MMU_PERF 0x04
+#define EXEC_DECODE_PERF 0x08
+#define EXEC_MMU_CHECK 0x10
+#define EXEC_DECODE_CHECK 0x20
+
+#define EXEC_DEFAULT                                                      \
+  ((CONFIG_IS_ENABLED(INSTR_LOG) ? EXEC_INSTR_LOG : 0) |                  \
+      (CONFIG_IS_ENABLED(FUNCTION_TRACE_LOG) ? EXEC_FUNCTION_TRACE : 0) | \
+      (CONFIG_IS_ENABLED(MMU_CACHE_PERF) ? EXEC_MMU_PERF : 0) |           \
+      (CONFIG_IS_ENABLED(DECODE_CACHE_PERF) ? EXEC_DECODE_PERF : 0) |     \
+      (CONFIG_IS_ENABLED(MMU_CACHE_CHECK) ? EXEC_MMU_CHECK : 0) |         \
+      (CONFIG_IS_ENABLED(DECODE_CACHE_CHECK) ? EXEC_DECODE_CHECK : 0))
+
+/* the set of the copy being compiled */
+#define EXEC_FEATURES EXEC_DEFAULT
+#define exec_has(f) (EXEC_FEATURES & EXEC_##f)
+
+#if CONFIG_EXEC_VARIANTS
+/* the set of the copy selected to run */
+static uint32_t exec_features = 0;
+#else
+#  define exec_features EXEC_DEFAULT
+#endif
+
+/* hardware irq lines, devices flip them without a lock and
+ * the cpu copies them into IP[7:2] of Cause */
+static __percpu volatile uint32_t irq_lines = 0;
+
+/* set whenever the cpu has to leave straight-line execution,
+ * i.e. an irq was raised, interrupts may have been enabled,
+ * the earliest timer changed or nemu_state was set */
+static __percpu volatile bool cpu_kicked = true;
+
+/* a waiting cpu sleeps in slices, so a kick from a signal
+ * handler, which cannot signal the condition, is still seen */
+#define CPU_WAIT_SLICE_US 10000
+
+static __percpu pthread_mutex_t cpu_wait_mut = PTHREAD_MUTEX_INITIALIZER;
+static __percpu pthread_cond_t cpu_wait_cond = PTHREAD_COND_INITIALIZER;
+
+/* set by cpu_wait under cpu_wait_mut, so wakers only take
+ * the lock when the cpu may really be sleeping */
+static __percpu volatile bool cpu_waiting = false;
+
+#if CONFIG_SMP
+/* requests other vcpus leave in cpu_flush, served with the
+ * next kick, see invalidate_decode_range */
+#  define FLUSH_DECODE 0x1
+#  define FLUSH_STORE_TLB 0x2
+
+static __percpu volatile uint32_t cpu_flush = 0;
+
+/* the per-cpu state other threads touch, registered by each
+ * vcpu when it starts */
+static struct {
+  volatile uint32_t *irq_lines;
+  volatile bool *cpu_kicked, *cpu_waiting;
+  pthread_mutex_t *cpu_wait_mut;
+  pthread_cond_t *cpu_wait_cond;
+  volatile uint32_t *cpu_flush;
+} vcpus[CONFIG_NR_CPUS];
+
+#  define per_cpu(var, id) (*vcpus[id].var)
+
+static void vcpu_register(int id) {
+  vcpus[id].irq_lines = &irq_lines;
+  vcpus[id].cpu_kicked = &cpu_kicked;
+  vcpus[id].cpu_waiting = &cpu_waiting;
+  vcpus[id].cpu_wait_mut = &cpu_wait_mut;
+  vcpus[id].cpu_wait_cond = &cpu_wait_cond;
+  __atomic_store_n(&vcpus[id].cpu_flush, &cpu_flush, __ATOMIC_RELEASE);
+}
+
+static bool vcpu_online(int id) {
+  return __atomic_load_n(&vcpus[id].cpu_flush, __ATOMIC_ACQUIRE) != NULL;
+}
+
+static void vcpu_request(int id, uint32_t flush) {
+  __atomic_fetch_or(vcpus[id].cpu_flush, flush, __ATOMIC_SEQ_CST);
+  __atomic_store_n(vcpus[id].cpu_kicked, true, __ATOMIC_SEQ_CST);
+}
+#else
+#  define per_cpu(var, id) (var)
+#endif
+
+static void cpu_wake(int id) {
+  __atomic_store_n(&per_cpu(cpu_kicked, id), true, __ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&per_cpu(cpu_waiting, id), __ATOMIC_SEQ_CST)) return;
+  pthread_mutex_lock(&per_cpu(cpu_wait_mut, id));
+  pthread_cond_signal(&per_cpu(cpu_wait_cond, id));
+  pthread_mutex_unlock(&per_cpu(cpu_wait_mut, id));
+}
 
+static void cpu_set_irq(int id, int irqno, bool val) {
   assert(2 <= irqno && irqno < 8);
-  pthread_mutex_lock(&mut);
   if (val) {
-    cpu.cp0.cause.IP |= 1 << irqno;
+    __atomic_fetch_or(&per_cpu(irq_lines, id), 1 << irqno, __ATOMIC_SEQ_CST);
+    cpu_wake(id);
   } else {
-    cpu.cp0.cause.IP &= ~(1 << irqno);
+    __atomic_fetch_and(
+        &per_cpu(irq_lines, id), ~(1 << irqno), __ATOMIC_SEQ_CST);
   }
-  pthread_mutex_unlock(&mut);
+}
+
+void nemu_set_irq(int irqno, bool val) { cpu_set_irq(0, irqno, val); }
+
+#if CONFIG_SMP
+void nemu_set_cpu_irq(int cpu_id, int irqno, bool val) {
+  assert(0 <= cpu_id && cpu_id < CONFIG_NR_CPUS);
+  if (vcpu_online(cpu_id)) cpu_set_irq(cpu_id, irqno, val);
+}
+#endif
+
+static ALWAYS_INLINE void sync_cause_ip() {
+  uint32_t lines = __atomic_load_n(&irq_lines, __ATOMIC_RELAXED);
+  cpu.cp0.cause.IP = (cpu.cp0.cause.IP & 3) | lines;
+#if CONFIG_MIPS32_R2
+  cpu.cp0.cause.TI = (lines >> 7) & 1; /* the timer is on ip7 */
+#endif
+}
+
+/* cached, recomputed whenever Status, Cause or the irq
+ * lines may have changed */
+static __percpu bool intr_deliverable = false;
+
+static ALWAYS_INLINE void update_intr_deliverable() {
+  sync_cause_ip();
+  bool ie = !(cpu.cp0.status.ERL) && !(cpu.cp0.status.EXL) && cpu.cp0.status.IE;
+  intr_deliverable = ie && (cpu.cp0.status.IM & cpu.cp0.cause.IP);
+}
+
+/* call after Status or Cause has been written */
+static void intrs_changed() {
+  update_intr_deliverable();
+  if (intr_deliverable) cpu_kicked = true;
 }
 
 // 1s = 10^3 ms = 10^6 us
 uint64_t get_current_time() { // in us
-#if 1
+#if CONFIG_VIRTUAL_TIME
+  return mips_get_count() / 50;
+#elif 1
   struct timeval t;
   gettimeofday(&t, NULL);
   return t.tv_sec * 1000000 + t.tv_usec - nemu_start_time;
@@ -77,11 +221,10 @@ uint64_t get_current_time() { // in us
 
 void print_registers(void) {
   static unsigned int ninstr = 0;
-#if CONFIG_INSTR_LOG
-  eprintf("$pc:    0x%08x", get_current_pc());
-#else
-  eprintf("$pc:    ????????");
-#endif
+  if (exec_features & EXEC_INSTR_LOG)
+    eprintf("$pc:    0x%08x", get_current_pc());
+  else
+    eprintf("$pc:    ????????");
   eprintf("   ");
   eprintf("$hi:    0x%08x", cpu.hi);
   eprintf("   ");
@@ -90,11 +233,10 @@ void print_registers(void) {
 
   eprintf("$ninstr: %08x", ninstr);
   eprintf("                  ");
-#if CONFIG_INSTR_LOG
-  eprintf("$instr: %08x", get_current_instr());
-#else
-  eprintf("$instr: ????????");
-#endif
+  if (exec_features & EXEC_INSTR_LOG)
+    eprintf("$instr: %08x", get_current_instr());
+  else
+    eprintf("$instr: ????????");
   eprintf("\n");
 
   for (int i = 0; i < 32; i++) {
@@ -125,26 +267,122 @@ void check_usual_registers(void) {
 
 #endif
 
-#if CONFIG_MMU_CACHE_PERF
+#if CONFIG_MMU_CACHE_PERF || CONFIG_EXEC_VARIANTS
 uint64_t mmu_cache_hit = 0;
 uint64_t mmu_cache_miss = 0;
 #endif
 
 #define MMU_BITS 12
+#define MMU_ID_BITS (32 - 12 - MMU_BITS)
+#define MMU_GEN_BITS 14
 
-struct mmu_cache_t {
+/* soft tlb, loads and stores have their own entries and
+ * instruction fetch goes through the fetch cache, a hit
+ * turns vaddr into the host address by adding addend */
+struct soft_tlb_t {
   uint32_t id;
-  uint8_t *ptr;
+  uintptr_t addend;
+};
+
+static __percpu struct soft_tlb_t load_tlb[1 << MMU_BITS];
+static __percpu struct soft_tlb_t store_tlb[1 << MMU_BITS];
+
+/* mappings larger than a page, consulted on a soft tlb miss
+ * so a large page refills without a translation */
+#define NR_LARGE_PAGE 8
+
+struct large_page_t {
+  uint32_t ctx;
+  vaddr_t vaddr;
+  paddr_t paddr;
+  uint32_t mask; /* size - 1 */
+  uintptr_t addend;
   bool can_write;
 };
 
-static struct mmu_cache_t mmu_cache[1 << MMU_BITS];
+static __percpu struct large_page_t large_pages[NR_LARGE_PAGE];
+static __percpu uint32_t large_page_victim = 0;
+
+/* cached translations are tagged with the context they were
+ * made in, i.e. the asid, ERL, user mode and a generation,
+ * so that switching address spaces or modes keeps them, a
+ * kernel translation is never hit from user mode, and
+ * bumping the generation drops all of them */
+static __percpu uint32_t mmu_gen = 0;
+static __percpu uint32_t mmu_ctx = 0;
+
+/* virtual page of pc -> decoded physical page */
+struct fetch_cache_t {
+  uint32_t id;
+  uintptr_t addend;
+  struct decode_page_t *page;
+};
+
+static __percpu struct fetch_cache_t fetch_cache[1 << MMU_BITS];
+
+/* bumped whenever the fetch cache is cleared, block links
+ * set up under an older epoch are stale */
+static __percpu uint32_t fetch_epoch = 0;
+
+static inline void clear_fetch_cache() {
+  for (int i = 0; i < sizeof(fetch_cache) / sizeof(*fetch_cache); i++) {
+    fetch_cache[i].id = 0xFFFFFFFF;
+  }
+  fetch_epoch++;
+}
+
+/* call after the asid, UM, EXL or ERL may have changed */
+static inline void update_mmu_ctx() {
+  bool user = cpu.cp0.status.UM && !cpu.cp0.status.EXL &&
+              !cpu.cp0.status.ERL;
+  uint32_t ctx = (mmu_gen << 10) | (user << 9) |
+                 (cpu.cp0.status.ERL << 8) | cpu.cp0.entry_hi.asid;
+  ctx <<= MMU_ID_BITS;
+  if (ctx != mmu_ctx) {
+    mmu_ctx = ctx;
+    fetch_epoch++; /* block links are not tagged */
+  }
+}
+
+/* physical page -> its decoded instructions, stores into
+ * such a page must not hit the store tlb */
+static __percpu struct decode_page_t *decode_pages[1 << (29 - 12)];
+
+#if CONFIG_SMP
+/* physical page -> the vcpus that decoded it */
+static uint8_t code_page_cpus[1 << (29 - 12)];
+#endif
+
+static ALWAYS_INLINE bool is_code_page(paddr_t paddr) {
+#if CONFIG_SMP
+  return __atomic_load_n(&code_page_cpus[ioremap(paddr) >> 12],
+             __ATOMIC_RELAXED) != 0;
+#else
+  return decode_pages[ioremap(paddr) >> 12] != NULL;
+#endif
+}
+
+#if CONFIG_SMP
+/* another vcpu decoded a page this one may store into */
+static void clear_store_tlb() {
+  for (int i = 0; i < sizeof(store_tlb) / sizeof(*store_tlb); i++)
+    store_tlb[i].id = 0xFFFFFFFF;
+}
+#endif
 
 static inline void clear_mmu_cache() {
-  for (int i = 0; i < sizeof(mmu_cache) / sizeof(*mmu_cache); i++) {
-    mmu_cache[i].id = 0xFFFFFFFF;
-    mmu_cache[i].ptr = NULL;
+  /* an all-ones id is never valid */
+  if (++mmu_gen == (1 << MMU_GEN_BITS) - 1) {
+    mmu_gen = 0;
+    for (int i = 0; i < sizeof(load_tlb) / sizeof(*load_tlb); i++) {
+      load_tlb[i].id = 0xFFFFFFFF;
+      store_tlb[i].id = 0xFFFFFFFF;
+    }
+    for (int i = 0; i < NR_LARGE_PAGE; i++) large_pages[i].ctx = 0xFFFFFFFF;
+    clear_fetch_cache();
   }
+
+  update_mmu_ctx();
 }
 
 static ALWAYS_INLINE uint32_t mmu_cache_index(vaddr_t vaddr) {
@@ -152,34 +390,200 @@ static ALWAYS_INLINE uint32_t mmu_cache_index(vaddr_t vaddr) {
 }
 
 static ALWAYS_INLINE uint32_t mmu_cache_id(vaddr_t vaddr) {
-  return (vaddr >> (12 + MMU_BITS));
+  return (vaddr >> (12 + MMU_BITS)) | mmu_ctx;
 }
 
-static ALWAYS_INLINE void update_mmu_cache(
-    vaddr_t vaddr, paddr_t paddr, device_t *dev, bool can_write) {
-#if CONFIG_MMU_CACHE_PERF
-  mmu_cache_miss++;
+static ALWAYS_INLINE uint8_t *soft_tlb_host(
+    struct soft_tlb_t *e, vaddr_t vaddr) {
+  return (uint8_t *)(uintptr_t)vaddr + e->addend;
+}
+
+/* drop the translations made through tlb[i], which are the
+ * only ones overwriting this entry can make stale */
+void invalidate_tlb_entry(uint32_t i) {
+  extern __percpu tlb_entry_t tlb[NR_TLB_ENTRY];
+  uint32_t npages = (tlb[i].pagemask + 1) << 1;
+  if (npages >= (1 << MMU_BITS)) {
+    clear_mmu_cache();
+    return;
+  }
+
+  vaddr_t vaddr = (tlb[i].vpn & ~tlb[i].pagemask) << 13;
+  for (int j = 0; j < NR_LARGE_PAGE; j++) {
+    struct large_page_t *lp = &large_pages[j];
+    if (lp->vaddr - vaddr < (npages << 12) || vaddr - lp->vaddr <= lp->mask)
+      lp->ctx = 0xFFFFFFFF;
+  }
+
+  for (; npages > 0; npages--, vaddr += 0x1000) {
+    uint32_t idx = mmu_cache_index(vaddr);
+    uint32_t id = vaddr >> (12 + MMU_BITS);
+    if ((load_tlb[idx].id & ((1 << MMU_ID_BITS) - 1)) == id)
+      load_tlb[idx].id = 0xFFFFFFFF;
+    if ((store_tlb[idx].id & ((1 << MMU_ID_BITS) - 1)) == id)
+      store_tlb[idx].id = 0xFFFFFFFF;
+    if ((fetch_cache[idx].id & ((1 << MMU_ID_BITS) - 1)) == id)
+      fetch_cache[idx].id = 0xFFFFFFFF;
+  }
+  fetch_epoch++;
+}
+
+/* remember a mapping larger than a page, clipped to the
+ * part backed by dev */
+static void large_page_insert(vaddr_t vaddr, paddr_t paddr, device_t *dev,
+    uint8_t *host, mmu_attr_t *attr) {
+  paddr = ioremap(paddr);
+  uint32_t size = 1u << attr->pgshift;
+  while (size > 0x1000 && ((paddr & ~(size - 1)) < dev->start ||
+                              (paddr | (size - 1)) - dev->start >= dev->size))
+    size >>= 1;
+  if (size <= 0x1000) return;
+
+  struct large_page_t *lp = &large_pages[large_page_victim];
+  large_page_victim = (large_page_victim + 1) % NR_LARGE_PAGE;
+  lp->ctx = mmu_ctx;
+  lp->vaddr = vaddr & ~(size - 1);
+  lp->paddr = paddr & ~(size - 1);
+  lp->mask = size - 1;
+  lp->addend = (uintptr_t)host - (vaddr & ~0xFFF);
+  lp->can_write = attr->dirty;
+}
+
+static ALWAYS_INLINE struct large_page_t *large_page_lookup(vaddr_t vaddr) {
+  for (int i = 0; i < NR_LARGE_PAGE; i++) {
+    struct large_page_t *lp = &large_pages[i];
+    if (lp->ctx == mmu_ctx && vaddr - lp->vaddr <= lp->mask) return lp;
+  }
+  return NULL;
+}
+
+static ALWAYS_INLINE void soft_tlb_fill(
+    struct soft_tlb_t *tlb, vaddr_t vaddr, uintptr_t addend) {
+  uint32_t idx = mmu_cache_index(vaddr);
+  tlb[idx].id = mmu_cache_id(vaddr);
+  tlb[idx].addend = addend;
+}
+
+static ALWAYS_INLINE void update_mmu_cache(vaddr_t vaddr, paddr_t paddr,
+    device_t *dev, mmu_attr_t *attr, uint32_t features) {
+#if CONFIG_MMU_CACHE_PERF || CONFIG_EXEC_VARIANTS
+  if (features & EXEC_MMU_PERF) mmu_cache_miss++;
 #endif
   if (cpu.has_exception) return;
   if (dev->map) {
-    uint32_t idx = mmu_cache_index(vaddr);
-    mmu_cache[idx].id = mmu_cache_id(vaddr);
-    mmu_cache[idx].ptr = dev->map((paddr & ~0xFFF) - dev->start, 0);
-    mmu_cache[idx].can_write = can_write;
-    assert(mmu_cache[idx].ptr);
+    uint8_t *host = dev->map((paddr & ~0xFFF) - dev->start, 0);
+    assert(host);
+    uintptr_t addend = (uintptr_t)host - (vaddr & ~0xFFF);
+    if (attr->rwbit == MMU_LOAD)
+      soft_tlb_fill(load_tlb, vaddr, addend);
+    else if (!(CONFIG_IS_ENABLED(DECODE_CACHE) && is_code_page(paddr)))
+      soft_tlb_fill(store_tlb, vaddr, addend);
+    if (!CONFIG_IS_ENABLED(SEGMENT) && attr->pgshift > 12)
+      large_page_insert(vaddr, paddr, dev, host, attr);
+  }
+}
+
+/* a soft tlb miss inside a cached large page, loads and
+ * stores to code pages still need the slow path */
+static ALWAYS_INLINE bool large_page_refill(vaddr_t vaddr, bool rwbit) {
+  struct large_page_t *lp = large_page_lookup(vaddr);
+  if (!lp) return false;
+  if (rwbit == MMU_LOAD) {
+    soft_tlb_fill(load_tlb, vaddr, lp->addend);
+    return true;
   }
+
+  if (!lp->can_write) return false;
+  if (CONFIG_IS_ENABLED(DECODE_CACHE) &&
+      is_code_page(lp->paddr + (vaddr - lp->vaddr)))
+    return false;
+  soft_tlb_fill(store_tlb, vaddr, lp->addend);
+  return true;
 }
 
-static ALWAYS_INLINE uint32_t vaddr_read(vaddr_t addr, int len) {
+#if CONFIG_SMP
+/* devices are not thread safe, vcpus take turns at them */
+static pthread_mutex_t mmio_mut = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline uint32_t dev_read(device_t *dev, paddr_t paddr, int len) {
+#if CONFIG_SMP
+  if (!dev->map) {
+    pthread_mutex_lock(&mmio_mut);
+    uint32_t data = dev->read(paddr - dev->start, len);
+    pthread_mutex_unlock(&mmio_mut);
+    return data;
+  }
+#endif
+  return dev->read(paddr - dev->start, len);
+}
+
+static inline void dev_write(
+    device_t *dev, paddr_t paddr, int len, uint32_t data) {
+#if CONFIG_SMP
+  if (!dev->map) {
+    pthread_mutex_lock(&mmio_mut);
+    dev->write(paddr - dev->start, len, data);
+    pthread_mutex_unlock(&mmio_mut);
+    return;
+  }
+#endif
+  dev->write(paddr - dev->start, len, data);
+}
+
+#if CONFIG_POLL_SKIP
+/* a polling loop is the same load reading the same value
+ * from an unmapped device at a fixed period, with no mmio
+ * write in between */
+#  define POLL_SKIP_THRESHOLD 16
+#  define POLL_SKIP_MAX_PERIOD 64
+#  define POLL_SKIP_MAX_ITERS (1ull << 16)
+
+static __percpu struct {
+  vaddr_t pc;
+  paddr_t paddr;
+  uint32_t data;
+  uint32_t hits;
+  uint64_t icount, period;
+} mmio_poll;
+static uint64_t mmio_poll_skipped = 0;
+
+static void cpu_poll_skip(uint64_t period);
+
+static void mmio_poll_check(paddr_t paddr, uint32_t data) {
+  uint64_t period = nemu_icount - mmio_poll.icount;
+  if (cpu.pc == mmio_poll.pc && paddr == mmio_poll.paddr &&
+      data == mmio_poll.data && period == mmio_poll.period &&
+      period <= POLL_SKIP_MAX_PERIOD) {
+    if (++mmio_poll.hits >= POLL_SKIP_THRESHOLD) {
+      mmio_poll.hits = 0;
+      cpu_poll_skip(period);
+    }
+  } else {
+    mmio_poll.pc = cpu.pc;
+    mmio_poll.paddr = paddr;
+    mmio_poll.data = data;
+    mmio_poll.hits = 0;
+  }
+  mmio_poll.icount = nemu_icount;
+  mmio_poll.period = period;
+}
+#endif
+
+static ALWAYS_INLINE uint32_t exec_vaddr_read(
+    vaddr_t addr, int len, uint32_t features) {
   uint32_t idx = mmu_cache_index(addr);
-  if (CONFIG_IS_ENABLED(MMU_CACHE) && mmu_cache[idx].id == mmu_cache_id(addr)) {
-#if CONFIG_MMU_CACHE_PERF
-    mmu_cache_hit++;
+  if (CONFIG_IS_ENABLED(MMU_CACHE) &&
+      (load_tlb[idx].id == mmu_cache_id(addr) ||
+          large_page_refill(addr, MMU_LOAD))) {
+#if CONFIG_MMU_CACHE_PERF || CONFIG_EXEC_VARIANTS
+    if (features & EXEC_MMU_PERF) mmu_cache_hit++;
 #endif
-    uint32_t data = *((uint32_t *)&mmu_cache[idx].ptr[addr & 0xFFF]) &
-                    (~0u >> ((4 - len) << 3));
-#if CONFIG_MMU_CACHE_CHECK
-    assert(data == dbg_vaddr_read(addr, len));
+    /* only len bytes, ram may end right after addr */
+    uint32_t data = 0;
+    memcpy(&data, soft_tlb_host(&load_tlb[idx], addr), len);
+#if CONFIG_MMU_CACHE_CHECK || CONFIG_EXEC_VARIANTS
+    if (features & EXEC_MMU_CHECK) assert(data == dbg_vaddr_read(addr, len));
 #endif
     return data;
   } else {
@@ -187,8 +591,11 @@ static ALWAYS_INLINE uint32_t vaddr_read(vaddr_t addr, int len) {
     paddr_t paddr = prot_addr_with_attr(addr, &attr);
     device_t *dev = find_device(paddr);
     CPUAssert(dev && dev->read, "bad addr %08x\n", addr);
-    update_mmu_cache(addr, paddr, dev, attr.dirty);
-    uint32_t data = dev->read(paddr - dev->start, len);
+    update_mmu_cache(addr, paddr, dev, &attr, features);
+    uint32_t data = dev_read(dev, paddr, len);
+#if CONFIG_POLL_SKIP
+    if (!dev->map) mmio_poll_check(paddr, data);
+#endif
 #if CONFIG_MMIO_ACCESS_LOG
     if (strcmp(CONFIG_MMIO_ACCESS_LOG_DEVICE, dev->name) == 0) {
       eprintf("[NEMU] R(%s, %08x, %d) -> %08x\n", dev->name, paddr - dev->start,
@@ -199,46 +606,263 @@ static ALWAYS_INLINE uint32_t vaddr_read(vaddr_t addr, int len) {
   }
 }
 
-static ALWAYS_INLINE void vaddr_write(vaddr_t addr, int len, uint32_t data) {
+static ALWAYS_INLINE void exec_vaddr_write(
+    vaddr_t addr, int len, uint32_t data, uint32_t features) {
   uint32_t idx = mmu_cache_index(addr);
-  if (CONFIG_IS_ENABLED(MMU_CACHE) && mmu_cache[idx].id == mmu_cache_id(addr) &&
-      mmu_cache[idx].can_write) {
-#if CONFIG_MMU_CACHE_PERF
-    mmu_cache_hit++;
-#endif
-#if CONFIG_MMU_CACHE_CHECK
-    extern device_t blackhole_dev;
-    paddr_t paddr = prot_addr(addr, MMU_STORE);
-    assert(paddr != blackhole_dev.start);
-    device_t *dev = find_device(paddr);
-    assert(dev && dev->map);
-    assert(mmu_cache[idx].ptr == dev->map((paddr & ~0xFFF) - dev->start, 0));
+  if (CONFIG_IS_ENABLED(MMU_CACHE) &&
+      (store_tlb[idx].id == mmu_cache_id(addr) ||
+          large_page_refill(addr, MMU_STORE))) {
+#if CONFIG_MMU_CACHE_PERF || CONFIG_EXEC_VARIANTS
+    if (features & EXEC_MMU_PERF) mmu_cache_hit++;
 #endif
-    memcpy(&mmu_cache[idx].ptr[addr & 0xFFF], &data, len);
+#if CONFIG_MMU_CACHE_CHECK || CONFIG_EXEC_VARIANTS
+    if (features & EXEC_MMU_CHECK) {
+      extern device_t blackhole_dev;
+      paddr_t paddr = prot_addr(addr, MMU_STORE);
+      assert(paddr != blackhole_dev.start);
+      device_t *dev = find_device(paddr);
+      assert(dev && dev->map);
+      assert(soft_tlb_host(&store_tlb[idx], addr & ~0xFFF) ==
+             dev->map((paddr & ~0xFFF) - dev->start, 0));
+      assert(!is_code_page(paddr));
+    }
+#endif
+    memcpy(soft_tlb_host(&store_tlb[idx], addr), &data, len);
   } else {
-    paddr_t paddr = prot_addr(addr, MMU_STORE);
+    mmu_attr_t attr = {.rwbit = MMU_STORE, .exbit = 1};
+    paddr_t paddr = prot_addr_with_attr(addr, &attr);
     device_t *dev = find_device(paddr);
     CPUAssert(dev && dev->write, "bad addr %08x\n", addr);
-    update_mmu_cache(addr, paddr, dev, true);
+    update_mmu_cache(addr, paddr, dev, &attr, features);
 #if CONFIG_MMIO_ACCESS_LOG
     if (strcmp(CONFIG_MMIO_ACCESS_LOG_DEVICE, dev->name) == 0) {
       eprintf("[NEMU] W(%s, %08x, %d) -> %08x\n", dev->name, paddr - dev->start,
           len, data);
     }
 #endif
-    dev->write(paddr - dev->start, len, data);
+    dev_write(dev, paddr, len, data);
+#if CONFIG_POLL_SKIP
+    if (!dev->map) mmio_poll.hits = 0;
+#endif
+    if (CONFIG_IS_ENABLED(DECODE_CACHE) && UNLIKELY(is_code_page(paddr)))
+      invalidate_decode_range(paddr, len);
+  }
+}
+
+/* instruction fetch, goes through the fetch cache so code
+ * does not evict data from the soft tlb */
+static uint32_t instr_fetch_slow(vaddr_t pc) {
+  mmu_attr_t attr = {.rwbit = MMU_LOAD, .exbit = 1};
+  paddr_t paddr = prot_addr_with_attr(pc, &attr);
+  device_t *dev = find_device(paddr);
+  CPUAssert(dev && dev->read, "bad addr %08x\n", pc);
+  /* the decode cache fills its own entries */
+  if (!CONFIG_IS_ENABLED(DECODE_CACHE) && CONFIG_IS_ENABLED(MMU_CACHE) &&
+      !cpu.has_exception && dev->map) {
+    uint32_t idx = mmu_cache_index(pc);
+    uint8_t *host = dev->map((paddr & ~0xFFF) - dev->start, 0);
+    fetch_cache[idx].id = mmu_cache_id(pc);
+    fetch_cache[idx].addend = (uintptr_t)host - (pc & ~0xFFF);
+    fetch_cache[idx].page = NULL;
+  }
+  return dev_read(dev, paddr, 4);
+}
+
+static ALWAYS_INLINE uint32_t exec_instr_fetch(vaddr_t pc, uint32_t features) {
+  uint32_t idx = mmu_cache_index(pc);
+  if (CONFIG_IS_ENABLED(MMU_CACHE) && fetch_cache[idx].id == mmu_cache_id(pc)) {
+    uint32_t data = *(uint32_t *)((uint8_t *)(uintptr_t)pc +
+                                  fetch_cache[idx].addend);
+#if CONFIG_MMU_CACHE_CHECK || CONFIG_EXEC_VARIANTS
+    if (features & EXEC_MMU_CHECK) assert(data == dbg_vaddr_read(pc, 4));
+#endif
+    return data;
+  }
+  return instr_fetch_slow(pc);
+}
+
+/* ll reserves the word it read, sc fails once an eret came
+ * in between or the word no longer holds that value, which
+ * is how a store of another vcpu breaks the reservation */
+static ALWAYS_INLINE uint32_t exec_load_linked(
+    vaddr_t addr, uint32_t features) {
+  uint32_t data = exec_vaddr_read(addr, 4, features);
+  if (cpu.has_exception) return 0;
+  cpu.llbit = true;
+  cpu.lladdr = prot_addr(addr, MMU_LOAD);
+  cpu.llval = data;
+  return data;
+}
+
+static ALWAYS_INLINE bool exec_store_conditional(
+    vaddr_t addr, uint32_t data, uint32_t features) {
+  if (!cpu.llbit) return false;
+  cpu.llbit = false;
+
+  mmu_attr_t attr = {.rwbit = MMU_STORE, .exbit = 1};
+  paddr_t paddr = prot_addr_with_attr(addr, &attr);
+  if (cpu.has_exception || paddr != cpu.lladdr) return false;
+
+  device_t *dev = find_device(paddr);
+  if (dev && dev->map && !is_code_page(paddr)) {
+    uint8_t *host = dev->map((paddr & ~0xFFF) - dev->start, 0);
+    uint32_t expected = cpu.llval;
+    return __atomic_compare_exchange_n((uint32_t *)(host + (paddr & 0xFFF)),
+        &expected, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+
+  if (exec_vaddr_read(addr, 4, features) != cpu.llval) return false;
+  exec_vaddr_write(addr, 4, data, features);
+  return !cpu.has_exception;
+}
+
+/* as seen by the copy of cpu_exec being compiled */
+#define vaddr_read(addr, len) exec_vaddr_read(addr, len, EXEC_FEATURES)
+#define vaddr_write(addr, len, data) \
+  exec_vaddr_write(addr, len, data, EXEC_FEATURES)
+#define instr_fetch(pc) exec_instr_fetch(pc, EXEC_FEATURES)
+#define load_linked(addr) exec_load_linked(addr, EXEC_FEATURES)
+#define store_conditional(addr, data) \
+  exec_store_conditional(addr, data, EXEC_FEATURES)
+
+#if CONFIG_FPU
+void signal_exception(uint32_t exception);
+
+/* an operation is plain host sse2 arithmetic, run on clear
+ * host flags which then go to Cause and, unless one of them
+ * traps, to Flags. The guest rounding mode is only in effect
+ * during an operation, host float math elsewhere in nemu
+ * keeps rounding to nearest */
+static const int fpu_host_excepts[5] = {
+    FE_INEXACT, FE_UNDERFLOW, FE_OVERFLOW, FE_DIVBYZERO, FE_INVALID};
+static const int fpu_host_modes[4] = {
+    FE_TONEAREST, FE_TOWARDZERO, FE_UPWARD, FE_DOWNWARD};
+
+static uint32_t fpu_host_flags() {
+  int host = fetestexcept(FE_ALL_EXCEPT);
+  uint32_t flags = 0;
+  for (int i = 0; i < 5; i++)
+    if (host & fpu_host_excepts[i]) flags |= 1 << i;
+  return flags;
+}
+
+static void fpu_set_fcsr(uint32_t val) { cpu.fcsr = val & FCSR_MASK; }
+
+static void fpu_set_cause(uint32_t cause) {
+  cpu.fcsr &= ~(0x3F << FCSR_CAUSE_SHIFT);
+  cpu.fcsr |= cause << FCSR_CAUSE_SHIFT;
+}
+
+static ALWAYS_INLINE void fpu_enter() {
+  feclearexcept(FE_ALL_EXCEPT);
+  if (UNLIKELY(cpu.fcsr & FCSR_RM))
+    fesetround(fpu_host_modes[cpu.fcsr & FCSR_RM]);
+}
+
+/* after an operation, true if it traps, then its result is
+ * dropped and Flags are left alone */
+static bool fpu_trapped() {
+  if (UNLIKELY(cpu.fcsr & FCSR_RM)) fesetround(FE_TONEAREST);
+  uint32_t cause = fpu_host_flags();
+  fpu_set_cause(cause);
+  if (cause & (cpu.fcsr >> FCSR_ENABLES_SHIFT)) {
+    signal_exception(EXC_FPE);
+    return true;
+  }
+  cpu.fcsr |= cause << FCSR_FLAGS_SHIFT;
+  return false;
+}
+
+static void fpu_unimplemented() {
+  fpu_set_cause(FCSR_E >> FCSR_CAUSE_SHIFT);
+  signal_exception(EXC_FPE);
+}
+
+static ALWAYS_INLINE bool fpu_fcc(int cc) {
+  return (cpu.fcsr >> (cc ? 24 + cc : 23)) & 1;
+}
+
+static ALWAYS_INLINE void fpu_set_fcc(int cc, bool val) {
+  int bit = cc ? 24 + cc : 23;
+  cpu.fcsr = (cpu.fcsr & ~(1u << bit)) | ((uint32_t)val << bit);
+}
+
+/* a NaN result is the default quiet NaN of legacy MIPS,
+ * whose quiet bit is clear, unlike the one of x86 */
+static ALWAYS_INLINE float fpu_nan_s(float v) {
+  if (v != v) {
+    uint32_t nan = 0x7FBFFFFF;
+    memcpy(&v, &nan, sizeof(v));
+  }
+  return v;
+}
+
+static ALWAYS_INLINE double fpu_nan_d(double v) {
+  if (v != v) {
+    uint64_t nan = 0x7FF7FFFFFFFFFFFFull;
+    memcpy(&v, &nan, sizeof(v));
   }
+  return v;
 }
 
-#if CONFIG_DECODE_CACHE_PERF
+/* v rounded to the integer r, out of range and NaN give
+ * 2^31-1 and raise invalid */
+static uint32_t fpu_to_w(double v, double r) {
+  if (!(r >= -2147483648.0 && r < 2147483648.0)) {
+    feraiseexcept(FE_INVALID);
+    return 0x7FFFFFFF;
+  }
+  if (r != v) feraiseexcept(FE_INEXACT);
+  return (int32_t)r;
+}
+#endif
+
+#if CONFIG_JIT || CONFIG_AOT
+void signal_exception(uint32_t exception);
+
+uint32_t jit_vaddr_load(vaddr_t addr, int kind) {
+  int len = kind & JIT_LOAD_LEN_MASK;
+  if ((addr & (len - 1)) != 0) {
+#  if CONFIG_EXCEPTION
+    cpu.cp0.badvaddr = addr;
+    signal_exception(EXC_AdEL);
+    return 0;
+#  else
+    CPUAssert(0, "address(0x%08x) is unaligned, pc=%08x\n", addr, cpu.pc);
+#  endif
+  }
+
+  uint32_t data = exec_vaddr_read(addr, len, exec_features);
+  if (kind & JIT_LOAD_SIGNED)
+    data = len == 1 ? (int32_t)(int8_t)data : (int32_t)(int16_t)data;
+  return data;
+}
+
+void jit_vaddr_store(vaddr_t addr, uint32_t data, int len) {
+  if ((addr & (len - 1)) != 0) {
+#  if CONFIG_EXCEPTION
+    cpu.cp0.badvaddr = addr;
+    signal_exception(EXC_AdES);
+    return;
+#  else
+    CPUAssert(0, "address(0x%08x) is unaligned, pc=%08x\n", addr, cpu.pc);
+#  endif
+  }
+
+  exec_vaddr_write(addr, len, data, exec_features);
+}
+#endif
+
+#if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
 uint64_t decode_cache_hit = 0;
 uint64_t decode_cache_miss = 0;
 #endif
 
-#define DECODE_CACHE_BITS 12
+#define DECODE_PAGE_INSTRS (0x1000 >> 2)
+#define NR_DECODE_PAGE 1024
+
 typedef struct {
   const void *handler;
-  uint32_t id;
   union {
     struct {
       int rs, rt; // R and I
@@ -262,36 +886,395 @@ typedef struct {
 
   int sel; /* put here will improve performance */
 
-#if CONFIG_INSTR_LOG || CONFIG_DECODE_CACHE_CHECK
+#if CONFIG_FUSION && CONFIG_DELAYSLOT
+  /* branch whose delay slot is decoded, the slot is run
+   * straight from the branch */
+  bool slot_fused;
+#endif
+
+#if CONFIG_INSTR_LOG || CONFIG_DECODE_CACHE_CHECK || CONFIG_BLOCK_CACHE || \
+    CONFIG_EXEC_VARIANTS
   Inst inst;
 #endif
+
+#if CONFIG_JIT || CONFIG_AOT
+  /* compiled or translated run starting here, valid only
+   * while handler is the jit handler */
+  jit_code_t jit_code;
+  uint32_t jit_len;
+  const void *jit_handler; /* the interpreted one */
+#endif
 } decode_cache_t;
 
-static decode_cache_t decode_cache[1 << DECODE_CACHE_BITS];
+/* decoded instructions of a physical page, a page is put
+ * back to the free list when a store hits it */
+typedef struct decode_page_t {
+  paddr_t paddr;
+  uint32_t id; /* unique, tells a recycled page apart */
+  struct decode_page_t *next;
+  decode_cache_t instrs[DECODE_PAGE_INSTRS];
+} decode_page_t;
+
+#if CONFIG_SMP
+/* too large for thread-local storage, each vcpu allocates
+ * its own */
+static __percpu decode_page_t *decode_page_pool;
+#else
+static decode_page_t decode_page_pool[NR_DECODE_PAGE];
+#endif
+static __percpu decode_page_t *free_decode_pages = NULL;
+static __percpu uint32_t decode_page_id = 0;
+
+/* code without a host mapping is decoded on every fetch */
+static __percpu decode_page_t uncached_page;
+
+#if CONFIG_FUSION || CONFIG_AOT
+static ALWAYS_INLINE bool decode_is_uncached(decode_cache_t *d) {
+  return (uintptr_t)d - (uintptr_t)uncached_page.instrs <
+         sizeof(uncached_page.instrs);
+}
+#endif
+
+#if CONFIG_BLOCK_CACHE
+#  define BLOCK_CACHE_BITS 12
+#  define BLOCK_MAX_INSTRS 16
+#  define BLOCK_NR_EXITS 2
+
+/* a block is a window into the decoded instructions of a
+ * physical page, instrs[0, nscanned) have been executed and
+ * checked for the end of the block */
+typedef struct block_t {
+  paddr_t pc;
+  uint32_t page_id;
+  uint32_t ninstr; /* shrinks when the terminator is scanned */
+  uint32_t nscanned;
+  uint32_t nexits;
+  struct {
+    vaddr_t pc;
+    paddr_t ppc;
+    uint32_t epoch;
+    struct block_t *blk;
+  } exits[BLOCK_NR_EXITS]; /* chained successors */
+  decode_cache_t *instrs;
+#  if CONFIG_JIT
+  uint32_t nexec;
+#  endif
+} block_t;
+
+static __percpu block_t block_cache[1 << BLOCK_CACHE_BITS];
+static __percpu block_t uncached_block = {.pc = 0xFFFFFFFF};
+
+#  if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
+uint64_t block_cache_hit = 0;
+uint64_t block_cache_miss = 0;
+uint64_t block_chain_hit = 0;
+uint64_t jit_compiled_blocks = 0;
+#  endif
+#endif
+
+#if CONFIG_SMP
+static void code_page_release(uint32_t ppn) {
+  __atomic_fetch_and(
+      &code_page_cpus[ppn], ~(1 << cpu_current_id()), __ATOMIC_SEQ_CST);
+}
+#endif
 
 void clear_decode_cache() {
-  for (int i = 0; i < sizeof(decode_cache) / sizeof(*decode_cache); i++) {
-    decode_cache[i].handler = NULL;
+#if CONFIG_SMP
+  if (!decode_page_pool)
+    decode_page_pool = calloc(NR_DECODE_PAGE, sizeof(*decode_page_pool));
+#endif
+
+  free_decode_pages = NULL;
+  for (int i = 0; i < NR_DECODE_PAGE; i++) {
+    decode_page_t *page = &decode_page_pool[i];
+    if (decode_pages[page->paddr >> 12] == page) {
+      decode_pages[page->paddr >> 12] = NULL;
+#if CONFIG_SMP
+      code_page_release(page->paddr >> 12);
+#endif
+    }
+    page->next = free_decode_pages;
+    free_decode_pages = page;
+  }
+
+  /* blocks of dropped pages die with the page id */
+  clear_fetch_cache();
+}
+
+static void drop_decode_page(uint32_t ppn) {
+  decode_page_t *page = decode_pages[ppn];
+  decode_pages[ppn] = NULL;
+  page->next = free_decode_pages;
+  free_decode_pages = page;
+  clear_fetch_cache();
+#if CONFIG_SMP
+  code_page_release(ppn);
+#endif
+}
+
+/* other vcpus that decoded the range are asked to drop all
+ * they decoded, they do so at their next instruction */
+void invalidate_decode_range(paddr_t addr, uint32_t len) {
+  for (paddr_t p = addr & ~0xFFF; p - (addr & ~0xFFF) < len; p += 0x1000) {
+    uint32_t ppn = ioremap(p) >> 12;
+    if (decode_pages[ppn]) drop_decode_page(ppn);
+#if CONFIG_SMP
+    uint8_t cpus =
+        __atomic_exchange_n(&code_page_cpus[ppn], 0, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < CONFIG_NR_CPUS; i++)
+      if ((cpus >> i) & 1) vcpu_request(i, FLUSH_DECODE);
+#endif
   }
 }
 
-static ALWAYS_INLINE uint32_t decode_cache_index(vaddr_t vaddr) {
-  return vaddr & ((1 << DECODE_CACHE_BITS) - 1);
+static decode_page_t *alloc_decode_page(paddr_t paddr, uint8_t *host) {
+  if (!free_decode_pages) clear_decode_cache();
+
+  decode_page_t *page = free_decode_pages;
+  free_decode_pages = page->next;
+  page->paddr = paddr & ~0xFFF;
+  page->id = ++decode_page_id;
+  for (int i = 0; i < DECODE_PAGE_INSTRS; i++) page->instrs[i].handler = NULL;
+  decode_pages[paddr >> 12] = page;
+
+#if CONFIG_SMP
+  /* on every vcpu */
+  uint8_t cpus = __atomic_fetch_or(
+      &code_page_cpus[paddr >> 12], 1 << cpu_current_id(), __ATOMIC_SEQ_CST);
+  for (int i = 0; i < CONFIG_NR_CPUS && !cpus; i++)
+    if (i != cpu_current_id() && vcpu_online(i))
+      vcpu_request(i, FLUSH_STORE_TLB);
+#endif
+
+  /* stores into this page have to take the slow path */
+  for (int i = 0; i < sizeof(store_tlb) / sizeof(*store_tlb); i++) {
+    vaddr_t vaddr = ((store_tlb[i].id & ((1 << MMU_ID_BITS) - 1))
+                        << (12 + MMU_BITS)) | (i << 12);
+    if (soft_tlb_host(&store_tlb[i], vaddr) == host)
+      store_tlb[i].id = 0xFFFFFFFF;
+  }
+  return page;
 }
 
-static ALWAYS_INLINE uint32_t decode_cache_id(vaddr_t vaddr) {
-  return (vaddr >> DECODE_CACHE_BITS);
+/* decoded code is dropped on every store into it, so only a
+ * hit invalidate of the icache has anything left to do, for
+ * the line it names, index and dcache ops are no-ops */
+#define CACHE_PRIMARY_I 0x00
+#define CACHE_HIT_INVALIDATE 0x10
+
+static void cache_op(uint32_t op, vaddr_t addr) {
+  if (op != (CACHE_HIT_INVALIDATE | CACHE_PRIMARY_I)) return;
+
+  mmu_attr_t attr = {.rwbit = MMU_LOAD, .exbit = 0};
+  paddr_t paddr = prot_addr_with_attr(addr, &attr);
+  uint32_t line = 2 << cpu.cp0.config1.IL;
+  invalidate_decode_range(paddr & ~(line - 1), line);
+}
+
+/* pc is translated without raising an exception, a failed
+ * translation maps to a device without host mapping, then
+ * the fetch itself raises the exception */
+static decode_page_t *decode_page_lookup(vaddr_t pc) {
+  mmu_attr_t attr = {.rwbit = MMU_LOAD, .exbit = 0};
+  paddr_t paddr = ioremap(prot_addr_with_attr(pc, &attr));
+  device_t *dev = find_device(paddr);
+  if (!dev || !dev->map) {
+    uncached_page.instrs[(pc & 0xFFF) >> 2].handler = NULL;
+    return &uncached_page;
+  }
+
+  uint8_t *host = dev->map((paddr & ~0xFFF) - dev->start, 0);
+  decode_page_t *page = decode_pages[paddr >> 12];
+  if (!page) page = alloc_decode_page(paddr, host);
+
+  uint32_t idx = mmu_cache_index(pc);
+  fetch_cache[idx].id = mmu_cache_id(pc);
+  fetch_cache[idx].addend = (uintptr_t)host - (pc & ~0xFFF);
+  fetch_cache[idx].page = page;
+  return page;
+}
+
+static ALWAYS_INLINE decode_page_t *decode_page_fetch(vaddr_t pc) {
+  uint32_t idx = mmu_cache_index(pc);
+  if (LIKELY(fetch_cache[idx].id == mmu_cache_id(pc)))
+    return fetch_cache[idx].page;
+  return decode_page_lookup(pc);
 }
 
 static ALWAYS_INLINE decode_cache_t *decode_cache_fetch(vaddr_t pc) {
-  uint32_t idx = decode_cache_index(pc);
-  uint32_t id = decode_cache_id(pc);
-  if (decode_cache[idx].id != id) {
-    decode_cache[idx].handler = NULL;
-    decode_cache[idx].id = id;
+  return &decode_page_fetch(pc)->instrs[(pc & 0xFFF) >> 2];
+}
+
+#if CONFIG_BLOCK_CACHE
+/* control transfers end a block after their delay slot,
+ * cop0 and cache instructions may flush the caches or
+ * change the translation, so they end a block directly */
+static inline int block_terminator_length(Inst inst) {
+  switch (inst.op) {
+  case 0x00: /* jr, jalr; syscall, break */
+    if (inst.func == 0x08 || inst.func == 0x09) break;
+    if (inst.func == 0x0c || inst.func == 0x0d) return 1;
+    return 0;
+  case 0x01: /* bltz, bgez, bltzl, bgezl, bltzal... */
+    if ((inst.rt & 0xc) == 0) break;
+    return 0;
+  case 0x02 ... 0x07: /* j, jal, beq, bne, blez, bgtz */
+  case 0x14 ... 0x17: /* beql, bnel, blezl, bgtzl */ break;
+  case 0x11: /* bc1f, bc1t, bc1fl, bc1tl */
+    if (inst.rs == 0x08) break;
+    return 0;
+  case 0x10: /* cop0 */
+  case 0x2f: /* cache */ return 1;
+  default: return 0;
+  }
+  return CONFIG_IS_ENABLED(DELAYSLOT) ? 2 : 1;
+}
+
+/* instrs[0, i] have just been executed */
+static ALWAYS_INLINE void block_scan(block_t *blk, uint32_t i) {
+  for (; blk->nscanned <= i; blk->nscanned++) {
+    int len = block_terminator_length(blk->instrs[blk->nscanned].inst);
+    if (len > 0 && blk->nscanned + len < blk->ninstr)
+      blk->ninstr = blk->nscanned + len;
+  }
+}
+
+static ALWAYS_INLINE block_t *exec_block_cache_fetch(
+    vaddr_t pc, uint32_t features) {
+  decode_page_t *page = decode_page_fetch(pc);
+  decode_cache_t *instrs = &page->instrs[(pc & 0xFFF) >> 2];
+  if (UNLIKELY(page == &uncached_page)) {
+    uncached_block.ninstr = 1;
+    uncached_block.nscanned = 0;
+    uncached_block.nexits = 0;
+    uncached_block.instrs = instrs;
+    return &uncached_block;
+  }
+
+  paddr_t paddr = page->paddr | (pc & 0xFFF);
+  block_t *blk = &block_cache[(paddr >> 2) & ((1 << BLOCK_CACHE_BITS) - 1)];
+  if (blk->pc == paddr && blk->page_id == page->id) {
+#  if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
+    if (features & EXEC_DECODE_PERF) block_cache_hit++;
+#  endif
+    return blk;
+  }
+
+#  if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
+  if (features & EXEC_DECODE_PERF) block_cache_miss++;
+#  endif
+  /* a block never crosses a page, the next page may be
+   * mapped elsewhere or not at all */
+  uint32_t room = (0x1000 - (pc & 0xFFF)) >> 2;
+  blk->pc = paddr;
+  blk->page_id = page->id;
+  blk->ninstr = room < BLOCK_MAX_INSTRS ? room : BLOCK_MAX_INSTRS;
+  blk->nscanned = 0;
+  blk->nexits = 0;
+  blk->instrs = instrs;
+#  if CONFIG_JIT
+  blk->nexec = 0;
+#  endif
+  return blk;
+}
+
+/* follow the direct link from blk to the block at pc,
+ * and set up such a link on a miss */
+static ALWAYS_INLINE block_t *exec_block_chain(
+    block_t *blk, vaddr_t pc, uint32_t features) {
+  for (int i = 0; i < BLOCK_NR_EXITS; i++) {
+    block_t *next = blk->exits[i].blk;
+    if (blk->exits[i].pc == pc && blk->exits[i].epoch == fetch_epoch &&
+        next->pc == blk->exits[i].ppc) {
+#  if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
+      if (features & EXEC_DECODE_PERF) block_chain_hit++;
+#  endif
+      return next;
+    }
+  }
+
+  block_t *next = exec_block_cache_fetch(pc, features);
+  if (next != &uncached_block) {
+    int slot = blk->nexits++ % BLOCK_NR_EXITS;
+    blk->exits[slot].pc = pc;
+    blk->exits[slot].ppc = next->pc;
+    blk->exits[slot].epoch = fetch_epoch;
+    blk->exits[slot].blk = next;
+  }
+  return next;
+}
+
+#  define block_cache_fetch(pc) exec_block_cache_fetch(pc, EXEC_FEATURES)
+#  define block_chain(blk, pc) exec_block_chain(blk, pc, EXEC_FEATURES)
+#endif
+
+#if CONFIG_JIT
+/* compile every run of at least two supported instructions
+ * of a block and redirect the handler of its first one */
+static void jit_block(block_t *blk, const void *jit_handler) {
+  decode_cache_t *instrs = blk->instrs;
+  for (int i = 0; i < blk->ninstr;) {
+    if (instrs[i].handler == jit_handler) {
+      /* compiled through an overlapping block */
+      i += instrs[i].jit_len;
+      continue;
+    }
+
+    int len = 0;
+    while (i + len < blk->ninstr && instrs[i + len].handler &&
+           instrs[i + len].handler != jit_handler &&
+           jit_supported(instrs[i + len].inst))
+      len++;
+
+    if (len >= 2) {
+      Inst code[BLOCK_MAX_INSTRS];
+      for (int j = 0; j < len; j++) code[j] = instrs[i + j].inst;
+
+      jit_code_t fn = jit_compile(code, len);
+      if (!fn) {
+        /* code buffer exhausted, start over */
+        jit_reset();
+        clear_decode_cache();
+        return;
+      }
+      instrs[i].jit_code = fn;
+      instrs[i].jit_len = len;
+      instrs[i].jit_handler = instrs[i].handler;
+      instrs[i].handler = jit_handler;
+    }
+    i += len ? len : 1;
   }
-  return &decode_cache[idx];
+
+#  if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
+  if (exec_features & EXEC_DECODE_PERF) jit_compiled_blocks++;
+#  endif
 }
+#endif
+
+#if CONFIG_AOT
+/* a run translated ahead of time takes the place of the
+ * instruction just decoded at its start, as long as memory
+ * still holds what was translated, stores into the page
+ * drop the decoded page and the check is made again */
+static void aot_install(decode_cache_t *decode, const void *jit_handler) {
+  const aot_run_t *run = aot_lookup(cpu.pc);
+  if (!run || decode_is_uncached(decode)) return;
+
+  uint32_t idx = mmu_cache_index(cpu.pc);
+  if (fetch_cache[idx].id != mmu_cache_id(cpu.pc) ||
+      ((cpu.pc & 0xFFF) >> 2) + run->len > DECODE_PAGE_INSTRS)
+    return;
+
+  void *host = (uint8_t *)(uintptr_t)cpu.pc + fetch_cache[idx].addend;
+  if (memcmp(host, run->code, run->len * 4) != 0) return;
+
+  decode->jit_code = run->fn;
+  decode->jit_len = run->len;
+  decode->jit_handler = decode->handler;
+  decode->handler = jit_handler;
+}
+#endif
 
 void signal_exception(uint32_t exception) {
   int code = exception & 0xFFFF;
@@ -338,15 +1321,21 @@ void signal_exception(uint32_t exception) {
 
 #if CONFIG_SEGMENT
   cpu.base = 0; // kernel segment base is zero
+  clear_mmu_cache();
 #endif
 
-  clear_mmu_cache();
-  clear_decode_cache();
+  /* a tlb exception loads the asid of the entry */
+  update_mmu_ctx();
+  update_intr_deliverable(); /* EXL is set now */
 }
 
-int init_cpu(vaddr_t entry) {
-  nemu_start_time = get_current_time();
+static __percpu nemu_timer_t cp0_timer;
+
+static void cp0_timer_fire(void *opaque) {
+  cpu_set_irq((intptr_t)opaque, 7, 1);
+}
 
+static void init_vcpu(int id, vaddr_t entry) {
   cpu.cp0.count[0] = 0;
   cpu.cp0.compare = 0xFFFFFFFF;
 
@@ -359,11 +1348,16 @@ int init_cpu(vaddr_t entry) {
 
   cpu.pc = entry;
   cpu.cp0.cpr[CP0_PRID][0] = 0x00018000; // MIPS32 4Kc
+  cpu.cp0.ebase = 0x80000000 | id;
 
   // init cp0 config 0
   cpu.cp0.config.MT = 1; // standard MMU
   cpu.cp0.config.BE = 0; // little endian
   cpu.cp0.config.M = 1;  // config1 present
+#if CONFIG_MIPS32_R2
+  cpu.cp0.config.AR = 1; // release 2
+  cpu.cp0.cpr[CP0_STATUS][CP0_INTCTL_SEL] = 7 << 29; // IPTI, timer on ip7
+#endif
 
   // init cp0 config 1
   cpu.cp0.config1.DA = 3; // 4=$3+1 ways dcache
@@ -374,92 +1368,237 @@ int init_cpu(vaddr_t entry) {
   cpu.cp0.config1.IL = 3; // 16=2^($3 + 1) bytes per line
   cpu.cp0.config1.IS = 2; // 256=2^($2 + 6) sets
 
-  cpu.cp0.config1.MMU_size = 63; // 64 TLB entries
+  cpu.cp0.config1.MMU_size = NR_TLB_ENTRY - 1;
+#if CONFIG_FPU
+  cpu.cp0.config1.FP = 1;
+  fpu_set_fcsr(0);
+#endif
+#if CONFIG_PAGE_WALKER
+  cpu.cp0.config1.M = 1;                   // config2 present
+  cpu.cp0.cpr[CP0_CONFIG][2] = 0x80000000; // config3 present
+  cpu.cp0.cpr[CP0_CONFIG][3] = 1 << 24;    // PW, page table walker
+#endif
+  tlb_init();
+
+  nemu_timer_init(&cp0_timer, cp0_timer_fire, (void *)(intptr_t)id);
 
   /* initialize some cache */
   clear_mmu_cache();
   clear_decode_cache();
 
+#if CONFIG_SMP
+  vcpu_register(id);
+#endif
+}
+
+int init_cpu(vaddr_t entry) {
+  nemu_start_time = get_current_time();
+  init_vcpu(0, entry);
   return 0;
 }
 
 #if CONFIG_EXCEPTION || CONFIG_INTR
 static ALWAYS_INLINE void check_intrs() {
-  bool ie = !(cpu.cp0.status.ERL) && !(cpu.cp0.status.EXL) && cpu.cp0.status.IE;
-  if (ie && (cpu.cp0.status.IM & cpu.cp0.cause.IP)) {
-    signal_exception(EXC_INTR);
-  }
+  if (intr_deliverable) signal_exception(EXC_INTR);
 }
 #endif
 
-static uint64_t intr_ddl = 0;
-
 uint64_t mips_get_count() {
+#if CONFIG_VIRTUAL_TIME
+  return nemu_icount / CONFIG_VIRTUAL_TIME_INSTRS_PER_COUNT;
+#else
   return get_current_time() * 50; // for 50 MHZ
+#endif
 }
 
-static pthread_mutex_t cp0_intr_mut = PTHREAD_MUTEX_INITIALIZER;
-
 void update_interrupt_deadline() {
-  pthread_mutex_lock(&cp0_intr_mut);
   uint64_t count = mips_get_count();
   uint64_t count0 = count & ((1ull << 32) - 1);
   uint64_t compare = cpu.cp0.compare;
   if (compare < count0) compare = compare + (1ull << 32);
-  uint64_t intr_interval = compare - count;
-  intr_ddl = count + intr_interval;
-  pthread_mutex_unlock(&cp0_intr_mut);
+  nemu_timer_mod(&cp0_timer, count + (compare - count0));
+}
+
+void cpu_kick() {
+#if CONFIG_SMP
+  for (int i = 0; i < CONFIG_NR_CPUS; i++)
+    if (vcpu_online(i)) *vcpus[i].cpu_kicked = true;
+#endif
+  cpu_kicked = true;
+}
+
+#if CONFIG_VIRTUAL_TIME
+/* icount at which the earliest timer is due */
+static uint64_t timer_icount = 0;
+#endif
+
+static ALWAYS_INLINE bool cpu_needs_service() {
+#if CONFIG_VIRTUAL_TIME
+  return cpu_kicked || nemu_icount >= timer_icount;
+#else
+  return cpu_kicked;
+#endif
+}
+
+static void cpu_service() {
+  cpu_kicked = false;
+#if CONFIG_SMP
+  uint32_t flush = __atomic_exchange_n(&cpu_flush, 0, __ATOMIC_SEQ_CST);
+  if (flush & FLUSH_DECODE) clear_decode_cache();
+  if (flush & FLUSH_STORE_TLB) clear_store_tlb();
+#endif
+  nemu_timer_run(mips_get_count());
+  update_intr_deliverable();
+#if CONFIG_VIRTUAL_TIME
+  uint64_t deadline = nemu_timer_deadline();
+  if (deadline >= -1ull / CONFIG_VIRTUAL_TIME_INSTRS_PER_COUNT)
+    timer_icount = -1ull;
+  else
+    timer_icount = deadline * CONFIG_VIRTUAL_TIME_INSTRS_PER_COUNT;
+#endif
+#if CONFIG_EXCEPTION || CONFIG_INTR
+  if (!cpu.has_exception) check_intrs();
+#endif
 }
 
-#if CONFIG_INTR
-void check_cp0_timer() {
+/* block until the cpu is kicked, the Count deadline passes
+ * or limit_us elapsed, -1 for no limit */
+/* limit_us is host time, virtual time stands still while
+ * the cpu sleeps */
+static uint64_t host_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
 
-  /* update IP */
-  pthread_mutex_lock(&cp0_intr_mut);
-  if (mips_get_count() > intr_ddl) {
-    nemu_set_irq(7, 1);
-    intr_ddl = -1ull;
+static void cpu_sleep(uint64_t deadline, uint64_t limit_us) {
+  uint64_t end = limit_us == -1ull ? -1ull : host_time_us() + limit_us;
+
+  pthread_mutex_lock(&cpu_wait_mut);
+  __atomic_store_n(&cpu_waiting, true, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&cpu_kicked, __ATOMIC_SEQ_CST)) {
+    uint64_t wait = CPU_WAIT_SLICE_US;
+#if !CONFIG_VIRTUAL_TIME
+    uint64_t now = mips_get_count();
+    if (now >= deadline) break;
+    if ((deadline - now) / 50 < wait) wait = (deadline - now) / 50;
+#endif
+    if (end != -1ull) {
+      uint64_t now_us = host_time_us();
+      if (now_us >= end) break;
+      if (end - now_us < wait) wait = end - now_us;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += wait * 1000;
+    ts.tv_sec += ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+    pthread_cond_timedwait(&cpu_wait_cond, &cpu_wait_mut, &ts);
   }
-  pthread_mutex_unlock(&cp0_intr_mut);
+  cpu_waiting = false;
+  pthread_mutex_unlock(&cpu_wait_mut);
+  cpu_kicked = true; /* a timer may be due */
+}
+
+/* WAIT, sleep until an irq is raised or the next timer is
+ * due, in virtual time the clock jumps to that timer */
+static void cpu_wait() {
+  if (cpu_kicked || ((cpu.cp0.cause.IP | irq_lines) & cpu.cp0.status.IM))
+    return;
+
+  uint64_t deadline = nemu_timer_deadline();
+#if CONFIG_VIRTUAL_TIME
+  if (deadline != -1ull) {
+    if (nemu_icount < timer_icount) nemu_icount = timer_icount;
+    return;
+  }
+#endif
+
+  cpu_sleep(deadline, -1ull);
+}
+
+#if CONFIG_POLL_SKIP
+/* the guest spins on a register that did not change, only
+ * a device event or a timer ends the loop: sleep until one
+ * of them, at most a slice as some devices follow the host
+ * clock. virtual time is credited whole iterations up to
+ * the next timer, or a bounded number if there is none */
+static void cpu_poll_skip(uint64_t period) {
+  if (cpu_kicked || ((cpu.cp0.cause.IP | irq_lines) & cpu.cp0.status.IM))
+    return;
+
+  mmio_poll_skipped++;
+#  if CONFIG_VIRTUAL_TIME
+  if (timer_icount != -1ull) {
+    if (timer_icount > nemu_icount) {
+      uint64_t iters = (timer_icount - nemu_icount + period - 1) / period;
+      nemu_icount += iters * period;
+    }
+    return;
+  }
+  nemu_icount += POLL_SKIP_MAX_ITERS * period;
+#  endif
+
+  cpu_sleep(nemu_timer_deadline(), CPU_WAIT_SLICE_US);
 }
 #endif
 
 void nemu_epilogue() {
-#if CONFIG_MMU_CACHE_PERF
-  printf("mmu_cache: %lu/%lu = %lf\n", mmu_cache_hit,
-      mmu_cache_hit + mmu_cache_miss,
-      mmu_cache_hit / (double)(mmu_cache_hit + mmu_cache_miss));
+#if CONFIG_MMU_CACHE_PERF || CONFIG_EXEC_VARIANTS
+  if (exec_features & EXEC_MMU_PERF)
+    printf("mmu_cache: %lu/%lu = %lf\n", mmu_cache_hit,
+        mmu_cache_hit + mmu_cache_miss,
+        mmu_cache_hit / (double)(mmu_cache_hit + mmu_cache_miss));
 #endif
 
-#if CONFIG_DECODE_CACHE_PERF
-  printf("decode_cache: %lu/%lu = %lf\n", decode_cache_hit,
-      decode_cache_hit + decode_cache_miss,
-      decode_cache_hit / (double)(decode_cache_hit + decode_cache_miss));
+#if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
+  if (CONFIG_IS_ENABLED(DECODE_CACHE) && (exec_features & EXEC_DECODE_PERF))
+    printf("decode_cache: %lu/%lu = %lf\n", decode_cache_hit,
+        decode_cache_hit + decode_cache_miss,
+        decode_cache_hit / (double)(decode_cache_hit + decode_cache_miss));
 #endif
 
-#if CONFIG_INSTR_LOG
-  eprintf(">>>>>> last executed instructions\n");
-  print_instr_queue();
-  eprintf("\n");
+#if CONFIG_BLOCK_CACHE && (CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS)
+  if (exec_features & EXEC_DECODE_PERF)
+    printf("block_cache: %lu/%lu = %lf, chained: %lu\n", block_cache_hit,
+        block_cache_hit + block_cache_miss,
+        block_cache_hit / (double)(block_cache_hit + block_cache_miss),
+        block_chain_hit);
 #endif
 
-#if CONFIG_FUNCTION_TRACE_LOG
-  eprintf(">>>>>> function invocations\n");
-  print_frames();
-  eprintf("\n");
+#if CONFIG_JIT && (CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS)
+  if (exec_features & EXEC_DECODE_PERF)
+    printf("jit: %lu blocks compiled\n", jit_compiled_blocks);
+#endif
+
+#if CONFIG_POLL_SKIP && (CONFIG_MMU_CACHE_PERF || CONFIG_EXEC_VARIANTS)
+  if (exec_features & EXEC_MMU_PERF)
+    printf("mmio poll: %lu loops fast-forwarded\n", mmio_poll_skipped);
 #endif
 
+  if (exec_features & EXEC_INSTR_LOG) {
+    eprintf(">>>>>> last executed instructions\n");
+    print_instr_queue();
+    eprintf("\n");
+  }
+
+  if (exec_features & EXEC_FUNCTION_TRACE) {
+    eprintf(">>>>>> function invocations\n");
+    print_frames();
+    eprintf("\n");
+  }
+
 #if CONFIG_BACKTRACE_LOG
   eprintf(">>>>>> functions in stack\n");
   print_backtrace();
   eprintf("\n");
 #endif
 
-#if CONFIG_INSTR_LOG
-  eprintf(">>>>>> current registers\n");
-  print_registers();
-  eprintf("\n");
-#endif
+  if (exec_features & EXEC_INSTR_LOG) {
+    eprintf(">>>>>> current registers\n");
+    print_registers();
+    eprintf("\n");
+  }
 }
 
 void nemu_exit() {
@@ -468,6 +1607,97 @@ void nemu_exit() {
 }
 
 /* Simulate how the CPU works. */
+#if CONFIG_VIRTUAL_TIME || CONFIG_POLL_SKIP
+#  define retire(k) (n -= (k), nemu_icount += (k))
+#else
+#  define retire(k) (n -= (k))
+#endif
+
+#if CONFIG_ENGINE_TAILCALL
+#  ifdef __has_attribute
+#    if __has_attribute(musttail)
+#      define MUSTTAIL __attribute__((musttail))
+#    endif
+#  endif
+#  ifndef MUSTTAIL
+#    define MUSTTAIL /* left to sibling call optimization */
+#  endif
+
+/* handlers run at most this many instructions before they
+ * return to cpu_exec, which bounds the stack when calls
+ * are not turned into jumps */
+#  define TC_CHAIN_MAX 1024
+
+typedef uint64_t (*tc_handler_t)(decode_cache_t *decode, uint64_t n);
+
+#  define operands decode
+#  include "instr.h"
+#  include "instr-table.h"
+#endif
+
+#if CONFIG_EXEC_VARIANTS
+#  define EXEC_TRACE (EXEC_INSTR_LOG | EXEC_FUNCTION_TRACE)
+#  define EXEC_PROFILE (EXEC_MMU_PERF | EXEC_DECODE_PERF)
+#  define EXEC_CHECK (EXEC_MMU_CHECK | EXEC_DECODE_CHECK)
+
+#  undef EXEC_FEATURES
+#  define EXEC_FEATURES 0
+#  define EXEC_LOOP exec_fast
+#  include "exec.h"
+
+#  undef EXEC_FEATURES
+#  undef EXEC_LOOP
+#  define EXEC_FEATURES EXEC_TRACE
+#  define EXEC_LOOP exec_trace
+#  include "exec.h"
+
+#  undef EXEC_FEATURES
+#  undef EXEC_LOOP
+#  define EXEC_FEATURES EXEC_PROFILE
+#  define EXEC_LOOP exec_profile
+#  include "exec.h"
+
+#  undef EXEC_FEATURES
+#  undef EXEC_LOOP
+#  define EXEC_FEATURES EXEC_CHECK
+#  define EXEC_LOOP exec_check
+#  include "exec.h"
+
+static const struct {
+  const char *name;
+  uint32_t features;
+  void (*loop)(uint64_t n);
+} exec_variants[] = {
+    {"fast", 0, exec_fast},
+    {"trace", EXEC_TRACE, exec_trace},
+    {"profile", EXEC_PROFILE, exec_profile},
+    {"check", EXEC_CHECK, exec_check},
+};
+
+static void (*exec_loop)(uint64_t n) = exec_fast;
+#else
+#  define EXEC_LOOP exec_loop
+#  include "exec.h"
+#endif
+
+/* decoded instructions point into the copy that decoded
+ * them, so they are dropped when another copy takes over */
+bool cpu_set_exec_variant(const char *name) {
+#if CONFIG_EXEC_VARIANTS
+  for (int i = 0; i < sizeof(exec_variants) / sizeof(*exec_variants); i++) {
+    if (strcmp(exec_variants[i].name, name) != 0) continue;
+    exec_features = exec_variants[i].features;
+    exec_loop = exec_variants[i].loop;
+    clear_decode_cache();
+#  if CONFIG_JIT
+    jit_reset();
+#  endif
+    return true;
+  }
+#endif
+  return false;
+}
+
 void cpu_exec(uint64_t n) {
   if (work_mode == MODE_GDB && nemu_state != NEMU_END) {
     /* assertion failure handler */
@@ -485,59 +1715,54 @@ void cpu_exec(uint64_t n) {
     return;
   }
 
-#if CONFIG_INSTR_LOG
-  bool nemu_needs_commit = work_mode == MODE_LOG;
-#endif
-
   nemu_state = NEMU_RUNNING;
+  cpu_kick();
+  exec_loop(n);
 
-  for (; n > 0; n--) {
-#if CONFIG_INSTR_LOG
-    instr_enqueue_pc(cpu.pc);
-#endif
-
-#if CONFIG_EXCEPTION
-    if ((cpu.pc & 0x3) != 0) {
-      cpu.cp0.badvaddr = cpu.pc;
-      signal_exception(EXC_AdEL);
-      goto check_exception;
-    }
-#endif
-
-    /* should be bad state */
-#if CONFIG_WARN_PC_EQUALS_ZERO
-    if (cpu.pc == 0x0) {
-      printf("[NEMU] warning: cpu.pc == 0\n");
-      print_instr_queue();
-    }
-#endif
-
-#if CONFIG_DECODE_CACHE
-#  define operands decode
-    decode_cache_t *decode = decode_cache_fetch(cpu.pc);
-#else
-#  define operands (&inst)
-    Inst inst = {.val = vaddr_read(cpu.pc, 4)};
-#endif
-
-#include "instr.h"
-
-#if CONFIG_INSTR_LOG
-    if (nemu_needs_commit) print_registers();
-#endif
-
-#if CONFIG_EXCEPTION || CONFIG_INTR
-  check_exception:;
-    if (!cpu.has_exception) check_intrs(); /* soft intr */
+  if (nemu_state == NEMU_RUNNING) { nemu_state = NEMU_STOP; }
+}
 
-    if (cpu.has_exception) {
-      cpu.has_exception = false;
-      cpu.pc = cpu.br_target;
+#if CONFIG_SMP
+static struct {
+  vaddr_t pc;
+  uint32_t arg;
+  bool started;
+} vcpu_boot[CONFIG_NR_CPUS];
+
+/* a secondary vcpu runs along with vcpu 0, it stops when
+ * nemu_state leaves NEMU_RUNNING and goes on once it is
+ * back, until the end */
+static void *vcpu_main(void *opaque) {
+  int id = (intptr_t)opaque;
+  init_vcpu(id, vcpu_boot[id].pc);
+  cpu.gpr[R_a0] = vcpu_boot[id].arg;
+
+  while (nemu_state != NEMU_END) {
+    if (nemu_state == NEMU_RUNNING) {
+      exec_loop(-1);
+    } else {
+      cpu_kicked = false;
+      cpu_sleep(-1ull, CPU_WAIT_SLICE_US);
     }
-#endif
-
-    if (nemu_state != NEMU_RUNNING) { return; }
   }
+  return NULL;
+}
 
-  if (nemu_state == NEMU_RUNNING) { nemu_state = NEMU_STOP; }
+void cpu_start(int cpu_id, vaddr_t pc, uint32_t arg) {
+  assert(0 < cpu_id && cpu_id < CONFIG_NR_CPUS);
+  if (vcpu_boot[cpu_id].started) return;
+  vcpu_boot[cpu_id].started = true;
+  vcpu_boot[cpu_id].pc = pc;
+  vcpu_boot[cpu_id].arg = arg;
+
+  /* thread-local storage comes out of the stack */
+  pthread_t thd;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64 << 20);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int ret = pthread_create(&thd, &attr, vcpu_main, (void *)(intptr_t)cpu_id);
+  Assert(ret == 0, "cannot start vcpu %d", cpu_id);
+  pthread_attr_destroy(&attr);
 }
+#endif
@@ -0,0 +1,103 @@
+/* the main loop of cpu_exec, cpu.c builds it once for
+ * every set of EXEC_FEATURES it runs, as EXEC_LOOP */
+static void EXEC_LOOP(uint64_t n) {
+  bool nemu_needs_commit = exec_has(INSTR_LOG) && work_mode == MODE_LOG;
+
+#if CONFIG_BLOCK_CACHE
+  block_t *blk = NULL;
+  vaddr_t blk_pc = 0; /* blocks are physical, this is where we entered */
+#endif
+
+  for (; n > 0; retire(1)) {
+    /* timers, interrupts and stop requests */
+    if (UNLIKELY(cpu_needs_service())) {
+      cpu_service();
+#if CONFIG_EXCEPTION || CONFIG_INTR
+      if (cpu.has_exception) {
+        cpu.has_exception = false;
+        cpu.pc = cpu.br_target;
+      }
+#endif
+      if (nemu_state != NEMU_RUNNING) return;
+    }
+
+    if (exec_has(INSTR_LOG)) instr_enqueue_pc(cpu.pc);
+
+#if CONFIG_EXCEPTION
+    if ((cpu.pc & 0x3) != 0) {
+      cpu.cp0.badvaddr = cpu.pc;
+      signal_exception(EXC_AdEL);
+      goto check_exception;
+    }
+#endif
+
+    /* should be bad state */
+#if CONFIG_WARN_PC_EQUALS_ZERO
+    if (cpu.pc == 0x0) {
+      printf("[NEMU] warning: cpu.pc == 0\n");
+      print_instr_queue();
+    }
+#endif
+
+#if CONFIG_BLOCK_CACHE
+#  define operands decode
+    blk = blk ? block_chain(blk, cpu.pc) : block_cache_fetch(cpu.pc);
+    blk_pc = cpu.pc;
+    decode_cache_t *decode = blk->instrs;
+  block_next:;
+#elif CONFIG_DECODE_CACHE
+#  define operands decode
+    decode_cache_t *decode = decode_cache_fetch(cpu.pc);
+#else
+#  define operands (&inst)
+    Inst inst = {.val = instr_fetch(cpu.pc)};
+#endif
+
+#if CONFIG_ENGINE_TAILCALL
+    uint64_t chain = n < TC_CHAIN_MAX ? n : TC_CHAIN_MAX;
+    n -= chain - tc_entry(decode, chain);
+#else
+#  include "instr.h"
+#endif
+
+    if (nemu_needs_commit) print_registers();
+
+#if CONFIG_BLOCK_CACHE
+    /* stay inside the block while control flows sequentially,
+     * and follow the chained exit at its end unless the cpu
+     * was kicked */
+    if (LIKELY(!cpu.has_exception) && n > 1) {
+      uint32_t idx = decode - blk->instrs + 1;
+      if (UNLIKELY(idx > blk->nscanned)) block_scan(blk, idx - 1);
+      if (idx < blk->ninstr) {
+        if (cpu.pc == blk_pc + (idx << 2)) {
+          retire(1);
+          decode++;
+          if (exec_has(INSTR_LOG)) instr_enqueue_pc(cpu.pc);
+          goto block_next;
+        }
+      } else if ((cpu.pc & 0x3) == 0 && !cpu_needs_service()) {
+#  if CONFIG_JIT
+        /* compiled code is not traced */
+        if (UNLIKELY(++blk->nexec == JIT_HOT_THRESHOLD) && !exec_has(INSTR_LOG))
+          jit_block(blk, &&jit);
+#  endif
+        retire(1);
+        blk = block_chain(blk, cpu.pc);
+        blk_pc = cpu.pc;
+        decode = blk->instrs;
+        if (exec_has(INSTR_LOG)) instr_enqueue_pc(cpu.pc);
+        goto block_next;
+      }
+    }
+#endif
+
+#if CONFIG_EXCEPTION || CONFIG_INTR
+  check_exception:;
+    if (cpu.has_exception) {
+      cpu.has_exception = false;
+      cpu.pc = cpu.br_target;
+    }
+#endif
+  }
+}
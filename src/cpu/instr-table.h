@@ -0,0 +1,240 @@
+/* dispatch tables of instr.h, H(name) is the handler of
+ * an instruction in either engine */
+
+/* F(name) is H(name) with the fpu and an invalid one without */
+#if CONFIG_FPU
+#  define F(name) H(name)
+#else
+#  define F(name) H(inv)
+#endif
+
+/* R2(name) likewise for the release 2 instructions */
+#if CONFIG_MIPS32_R2
+#  define R2(name) H(name)
+#else
+#  define R2(name) H(inv)
+#endif
+
+/* clang-format off */
+/* R-type */
+static const void *special_table[64] = {
+    /* 0x00 */ H(sll), F(movci), H(srl), H(sra),
+    /* 0x04 */ H(sllv), H(inv), H(srlv), H(srav),
+    /* 0x08 */ H(jr), H(jalr), H(movz), H(movn),
+    /* 0x0c */ H(syscall), H(breakpoint), H(inv), H(sync),
+    /* 0x10 */ H(mfhi), H(mthi), H(mflo), H(mtlo),
+    /* 0x14 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x18 */ H(mult), H(multu), H(divide), H(divu),
+    /* 0x1c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x20 */ H(add), H(addu), H(sub), H(subu),
+    /* 0x24 */ H(and), H(or), H(xor), H(nor),
+    /* 0x28 */ H(inv), H(inv), H(slt), H(sltu),
+    /* 0x2c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x30 */ H(tge), H(tgeu), H(tlt), H(tltu),
+    /* 0x34 */ H(teq), H(inv), H(tne), H(inv),
+    /* 0x38 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x3c */ H(inv), H(inv), H(inv), H(inv),
+};
+
+static const void *special2_table[64] = {
+    /* 0x00 */ H(madd), H(maddu), H(mul), H(inv),
+    /* 0x04 */ H(msub), H(msubu), H(inv), H(inv),
+    /* 0x08 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x0c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x10 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x14 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x18 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x1c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x20 */ H(clz), H(inv), H(inv), H(inv),
+    /* 0x24 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x28 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x2c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x30 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x34 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x38 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x3c */ H(inv), H(inv), H(inv), H(inv),
+};
+
+static const void *special3_table[64] = {
+    /* 0x00 */ R2(ext), H(inv), H(mul), H(inv),
+    /* 0x04 */ R2(ins), H(inv), H(inv), H(inv),
+    /* 0x08 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x0c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x10 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x14 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x18 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x1c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x20 */ H(exec_bshfl), H(inv), H(inv), H(inv),
+    /* 0x24 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x28 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x2c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x30 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x34 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x38 */ H(inv), H(inv), H(inv), R2(rdhwr),
+    /* 0x3c */ H(inv), H(inv), H(inv), H(inv),
+};
+
+/* shamt */
+static const void *bshfl_table[64] = {
+    /* 0x00 */ H(inv), H(inv), R2(wsbh), H(inv),
+    /* 0x04 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x08 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x0c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x10 */ H(seb), H(inv), H(inv), H(inv),
+    /* 0x14 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x18 */ H(seh), H(inv), H(inv), H(inv),
+    /* 0x1c */ H(inv), H(inv), H(inv), H(inv),
+};
+
+/* I-type */
+static const void *regimm_table[64] = {
+    /* 0x00 */ H(bltz), H(bgez), H(bltzl), H(bgezl),
+    /* 0x04 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x08 */ H(tgei), H(tgeiu), H(tlti), H(tltiu),
+    /* 0x0c */ H(teqi), H(inv), H(tnei), H(inv),
+    /* 0x10 */ H(bltzal), H(bgezal), H(bltzall), H(bgezall),
+    /* 0x14 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x18 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x1c */ H(inv), H(inv), H(inv), R2(synci),
+};
+
+/* R-type */
+static const void *cop0_table_rs[32] = {
+    /* 0x00 */ H(mfc0), H(inv), H(inv), H(inv),
+    /* 0x04 */ H(mtc0), H(inv), H(inv), H(inv),
+    /* 0x08 */ H(inv),  H(inv), R2(rdpgpr), R2(mfmc0),
+    /* 0x0c */ H(inv),  H(inv), R2(wrpgpr), H(inv),
+    /* 0x10 */ H(inv),  H(inv), H(inv), H(inv),
+    /* 0x14 */ H(inv),  H(inv), H(inv), H(inv),
+    /* 0x18 */ H(inv),  H(inv), H(inv), H(inv),
+    /* 0x1c */ H(inv),  H(inv), H(inv), H(inv),
+};
+
+static const void *cop0_table_func[64] = {
+    /* 0x00 */ H(inv),  H(tlbr), H(tlbwi), H(inv),
+    /* 0x04 */ H(inv),  H(inv),  H(tlbwr), H(inv),
+    /* 0x08 */ H(tlbp), H(inv),  H(inv),   H(inv),
+    /* 0x0c */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x10 */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x14 */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x18 */ H(eret), H(inv),  H(inv),   H(inv),
+    /* 0x1c */ H(inv),  H(inv),  H(inv),   H(inv),
+
+    /* 0x20 */ H(wait),  H(inv),  H(inv),   H(inv),
+    /* 0x24 */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x28 */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x2c */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x30 */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x34 */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x38 */ H(inv),  H(inv),  H(inv),   H(inv),
+    /* 0x3c */ H(inv),  H(inv),  H(inv),   H(inv),
+};
+
+/* I-type */
+static const void *opcode_table[64] = {
+    /* 0x00 */ H(exec_special), H(exec_regimm), H(j), H(jal),
+    /* 0x04 */ H(beq), H(bne), H(blez), H(bgtz),
+    /* 0x08 */ H(addi), H(addiu), H(slti), H(sltiu),
+    /* 0x0c */ H(andi), H(ori), H(xori), H(lui),
+    /* 0x10 */ H(exec_cop0), F(exec_cop1), H(inv), H(inv),
+    /* 0x14 */ H(beql), H(bnel), H(blezl), H(bgtzl),
+    /* 0x18 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x1c */ H(exec_special2), H(inv), H(inv), H(exec_special3),
+    /* 0x20 */ H(lb), H(lh), H(lwl), H(lw),
+    /* 0x24 */ H(lbu), H(lhu), H(lwr), H(inv),
+    /* 0x28 */ H(sb), H(sh), H(swl), H(sw),
+    /* 0x2c */ H(inv), H(inv), H(swr), H(cache),
+    /* 0x30 */ H(ll), F(lwc1), H(inv), H(pref),
+    /* 0x34 */ H(inv), F(ldc1), H(inv), H(inv),
+    /* 0x38 */ H(sc), F(swc1), H(inv), H(inv),
+    /* 0x3c */ H(inv), F(sdc1), H(inv), H(inv),
+};
+
+#if CONFIG_FPU
+/* R-type, fmt ops have their own tables */
+static const void *cop1_table_rs[32] = {
+    /* 0x00 */ H(mfc1), H(inv), H(cfc1), R2(mfhc1),
+    /* 0x04 */ H(mtc1), H(inv), H(ctc1), R2(mthc1),
+    /* 0x08 */ H(bc1), H(inv), H(inv), H(inv),
+    /* 0x0c */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x10 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x14 */ H(inv), H(fpu_unimpl), H(fpu_unimpl), H(inv),
+    /* 0x18 */ H(inv), H(inv), H(inv), H(inv),
+    /* 0x1c */ H(inv), H(inv), H(inv), H(inv),
+};
+
+#  define C(fmt) H(c_##fmt), H(c_##fmt), H(c_##fmt), H(c_##fmt)
+#  define U H(fpu_unimpl)
+static const void *cop1_table_s[64] = {
+    /* 0x00 */ H(add_s), H(sub_s), H(mul_s), H(div_s),
+    /* 0x04 */ H(sqrt_s), H(abs_s), H(mov_s), H(neg_s),
+    /* 0x08 */ U, U, U, U,
+    /* 0x0c */ H(round_w_s), H(trunc_w_s), H(ceil_w_s), H(floor_w_s),
+    /* 0x10 */ U, H(movcf_s), H(movz_s), H(movn_s),
+    /* 0x14 */ U, U, U, U,
+    /* 0x18 */ U, U, U, U,
+    /* 0x1c */ U, U, U, U,
+    /* 0x20 */ U, H(cvt_d_s), U, U,
+    /* 0x24 */ H(cvt_w_s), U, U, U,
+    /* 0x28 */ U, U, U, U,
+    /* 0x2c */ U, U, U, U,
+    /* 0x30 */ C(s), C(s), C(s), C(s),
+};
+
+static const void *cop1_table_d[64] = {
+    /* 0x00 */ H(add_d), H(sub_d), H(mul_d), H(div_d),
+    /* 0x04 */ H(sqrt_d), H(abs_d), H(mov_d), H(neg_d),
+    /* 0x08 */ U, U, U, U,
+    /* 0x0c */ H(round_w_d), H(trunc_w_d), H(ceil_w_d), H(floor_w_d),
+    /* 0x10 */ U, H(movcf_d), H(movz_d), H(movn_d),
+    /* 0x14 */ U, U, U, U,
+    /* 0x18 */ U, U, U, U,
+    /* 0x1c */ U, U, U, U,
+    /* 0x20 */ H(cvt_s_d), U, U, U,
+    /* 0x24 */ H(cvt_w_d), U, U, U,
+    /* 0x28 */ U, U, U, U,
+    /* 0x2c */ U, U, U, U,
+    /* 0x30 */ C(d), C(d), C(d), C(d),
+};
+
+static const void *cop1_table_w[64] = {
+    /* 0x00 */ U, U, U, U, U, U, U, U,
+    /* 0x08 */ U, U, U, U, U, U, U, U,
+    /* 0x10 */ U, U, U, U, U, U, U, U,
+    /* 0x18 */ U, U, U, U, U, U, U, U,
+    /* 0x20 */ H(cvt_s_w), H(cvt_d_w), U, U, U, U, U, U,
+    /* 0x28 */ U, U, U, U, U, U, U, U,
+    /* 0x30 */ U, U, U, U, U, U, U, U,
+    /* 0x38 */ U, U, U, U, U, U, U, U,
+};
+#  undef C
+#  undef U
+#endif
+
+#if CONFIG_FUSION
+/* first, second, fused */
+static const void *fusion_table[NR_FUSION_PAIRS][3] = {
+    {H(lui), H(addiu), H(lui_addiu)},
+    {H(lui), H(ori), H(lui_ori)},
+    {H(lui), H(lw), H(lui_lw)},
+    {H(slt), H(beq), H(slt_beq)},
+    {H(slt), H(bne), H(slt_bne)},
+    {H(sltu), H(beq), H(sltu_beq)},
+    {H(sltu), H(bne), H(sltu_bne)},
+    {H(slti), H(beq), H(slti_beq)},
+    {H(slti), H(bne), H(slti_bne)},
+    {H(sltiu), H(beq), H(sltiu_beq)},
+    {H(sltiu), H(bne), H(sltiu_bne)},
+};
+
+#  if CONFIG_DELAYSLOT
+/* branches whose delay slot is always executed */
+static const void *slot_branches[NR_SLOT_BRANCHES] = {
+    H(beq), H(bne), H(blez), H(bgtz), H(j), H(jal), H(jr), H(jalr),
+};
+#  endif
+#endif
+
+#undef F
+#undef R2
+/* clang-format on */
@@ -1,21 +1,96 @@
-#define make_label(l) \
+#if CONFIG_ENGINE_TAILCALL
+/* every handler is a function, it advances pc on its own
+ * and tail-calls the handler of the next instruction, the
+ * body of a handler is a block inside its function */
+#  define make_label(l) \
+  l:                    \
+    __attribute__((unused));
+#  define make_handler(name) \
+    static uint64_t tc_##name(decode_cache_t *decode, uint64_t n) {
+#  define make_entry() make_handler(entry)
+#  define make_exec_handler(name) \
+    tc_epilogue();                \
+    }                             \
+    make_handler(name)
+#  define H(name) tc_##name
+#  define dispatch(h) MUSTTAIL return ((tc_handler_t)(h))(decode, n)
+
+#  if CONFIG_DECODE_CACHE_PERF || CONFIG_DECODE_CACHE_CHECK
+/* count and check every fetch */
+#    define tc_handler(d) ((const void *)tc_entry)
+#  else
+#    define tc_handler(d) ((d)->handler ? (d)->handler : (const void *)tc_entry)
+#  endif
+
+/* return to cpu_exec for exceptions, services and the end of
+ * the budget, the last instruction is retired there */
+#  define tc_next()                                             \
+    if (UNLIKELY(cpu.has_exception || n == 1 || (cpu.pc & 3) || \
+                 cpu_needs_service()))                          \
+      return n;                                                 \
+    retire(1);                                                  \
+    decode = decode_cache_fetch(cpu.pc);                        \
+    cpu.gpr[0] = 0;                                             \
+    dispatch(tc_handler(decode))
+
+#  if CONFIG_DELAYSLOT
+#    define tc_epilogue() \
+      advance_pc();       \
+      make_label(exit) tc_next()
+#  else
+#    define tc_epilogue() \
+      cpu.pc += 4;        \
+      make_label(exit) tc_next()
+#  endif
+#else
+#  define make_label(l) \
   l:
-#define make_entry()
-#define make_exit() make_label(exit)
+#  define make_entry()
+#  define make_exit() make_label(exit)
+#  if CONFIG_DELAYSLOT
+#    define make_exec_handler(name) \
+      goto inst_end;                \
+      make_label(name)
+#  else
+#    define make_exec_handler(name) \
+      cpu.pc += 4;                  \
+      goto exit;                    \
+      make_label(name)
+#  endif
+#  define H(name) &&name
+#  define dispatch(h) goto *(h)
+#endif
 
 #if CONFIG_DELAYSLOT
-#  define make_exec_handler(name) \
-    goto inst_end;                \
-    make_label(name)
-#  define prepare_delayslot() \
-    cpu.is_delayslot = true;  \
-    cpu.pc += 4;              \
-    goto exit;
+#  define advance_pc()            \
+    do {                          \
+      if (cpu.is_delayslot) {     \
+        cpu.pc = cpu.br_target;   \
+        cpu.is_delayslot = false; \
+      } else {                    \
+        cpu.pc += 4;              \
+      }                           \
+    } while (0)
+#  if CONFIG_FUSION
+/* the delay slot runs straight from the branch when it has
+ * been decoded */
+#    define prepare_delayslot()           \
+      cpu.is_delayslot = true;            \
+      cpu.pc += 4;                        \
+      if (decode->slot_fused && n >= 2) { \
+        cpu.gpr[0] = 0;                   \
+        retire(1);                        \
+        decode++;                         \
+        dispatch(decode->handler);        \
+      }                                   \
+      goto exit;
+#  else
+#    define prepare_delayslot() \
+      cpu.is_delayslot = true;  \
+      cpu.pc += 4;              \
+      goto exit;
+#  endif
 #else
-#  define make_exec_handler(name) \
-    cpu.pc += 4;                  \
-    goto exit;                    \
-    make_label(name)
 #  define prepare_delayslot() \
     cpu.pc = cpu.br_target;   \
     goto exit;
@@ -42,169 +117,61 @@ typedef union {
   int64_t sval;
 } L64_t;
 
-/* clang-format off */
-/* R-type */
-static const void *special_table[64] = {
-    /* 0x00 */ &&sll, &&inv, &&srl, &&sra,
-    /* 0x04 */ &&sllv, &&inv, &&srlv, &&srav,
-    /* 0x08 */ &&jr, &&jalr, &&movz, &&movn,
-    /* 0x0c */ &&syscall, &&breakpoint, &&inv, &&sync,
-    /* 0x10 */ &&mfhi, &&mthi, &&mflo, &&mtlo,
-    /* 0x14 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x18 */ &&mult, &&multu, &&divide, &&divu,
-    /* 0x1c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x20 */ &&add, &&addu, &&sub, &&subu,
-    /* 0x24 */ &&and, && or, &&xor, &&nor,
-    /* 0x28 */ &&inv, &&inv, &&slt, &&sltu,
-    /* 0x2c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x30 */ &&tge, &&tgeu, &&tlt, &&tltu,
-    /* 0x34 */ &&teq, &&inv, &&tne, &&inv,
-    /* 0x38 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x3c */ &&inv, &&inv, &&inv, &&inv,
-};
-
-static const void *special2_table[64] = {
-    /* 0x00 */ &&madd, &&maddu, &&mul, &&inv,
-    /* 0x04 */ &&msub, &&msubu, &&inv, &&inv,
-    /* 0x08 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x0c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x10 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x14 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x18 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x1c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x20 */ &&clz, &&inv, &&inv, &&inv,
-    /* 0x24 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x28 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x2c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x30 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x34 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x38 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x3c */ &&inv, &&inv, &&inv, &&inv,
-};
-
-static const void *special3_table[64] = {
-    /* 0x00 */ &&inv, &&inv, &&mul, &&inv,
-    /* 0x04 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x08 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x0c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x10 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x14 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x18 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x1c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x20 */ &&exec_bshfl, &&inv, &&inv, &&inv,
-    /* 0x24 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x28 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x2c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x30 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x34 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x38 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x3c */ &&inv, &&inv, &&inv, &&inv,
-};
-
-/* shamt */
-static const void *bshfl_table[64] = {
-    /* 0x00 */ &&inv, &&inv, &&mul, &&inv,
-    /* 0x04 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x08 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x0c */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x10 */ &&seb, &&inv, &&inv, &&inv,
-    /* 0x14 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x18 */ &&seh, &&inv, &&inv, &&inv,
-    /* 0x1c */ &&inv, &&inv, &&inv, &&inv,
-};
-
-/* I-type */
-static const void *regimm_table[64] = {
-    /* 0x00 */ &&bltz, &&bgez, &&bltzl, &&bgezl,
-    /* 0x04 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x08 */ &&tgei, &&tgeiu, &&tlti, &&tltiu,
-    /* 0x0c */ &&teqi, &&inv, &&tnei, &&inv,
-    /* 0x10 */ &&bltzal, &&bgezal, &&bltzall, &&bgezall,
-    /* 0x14 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x18 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x1c */ &&inv, &&inv, &&inv, &&inv,
-};
-
-/* R-type */
-static const void *cop0_table_rs[32] = {
-    /* 0x00 */ &&mfc0, &&inv, &&inv, &&inv,
-    /* 0x04 */ &&mtc0, &&inv, &&inv, &&inv,
-    /* 0x08 */ &&inv,  &&inv, &&inv, &&inv,
-    /* 0x0c */ &&inv,  &&inv, &&inv, &&inv,
-    /* 0x10 */ &&inv,  &&inv, &&inv, &&inv,
-    /* 0x14 */ &&inv,  &&inv, &&inv, &&inv,
-    /* 0x18 */ &&inv,  &&inv, &&inv, &&inv,
-    /* 0x1c */ &&inv,  &&inv, &&inv, &&inv,
-};
-
-static const void *cop0_table_func[64] = {
-    /* 0x00 */ &&inv,  &&tlbr, &&tlbwi, &&inv,
-    /* 0x04 */ &&inv,  &&inv,  &&tlbwr, &&inv,
-    /* 0x08 */ &&tlbp, &&inv,  &&inv,   &&inv,
-    /* 0x0c */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x10 */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x14 */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x18 */ &&eret, &&inv,  &&inv,   &&inv,
-    /* 0x1c */ &&inv,  &&inv,  &&inv,   &&inv,
-
-    /* 0x20 */ &&wait,  &&inv,  &&inv,   &&inv,
-    /* 0x24 */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x28 */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x2c */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x30 */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x34 */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x38 */ &&inv,  &&inv,  &&inv,   &&inv,
-    /* 0x3c */ &&inv,  &&inv,  &&inv,   &&inv,
-};
-
-/* I-type */
-static const void *opcode_table[64] = {
-    /* 0x00 */ &&exec_special, &&exec_regimm, &&j, &&jal,
-    /* 0x04 */ &&beq, &&bne, &&blez, &&bgtz,
-    /* 0x08 */ &&addi, &&addiu, &&slti, &&sltiu,
-    /* 0x0c */ &&andi, &&ori, &&xori, &&lui,
-    /* 0x10 */ &&exec_cop0, &&inv, &&inv, &&inv,
-    /* 0x14 */ &&beql, &&bnel, &&blezl, &&bgtzl,
-    /* 0x18 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x1c */ &&exec_special2, &&inv, &&inv, &&exec_special3,
-    /* 0x20 */ &&lb, &&lh, &&lwl, &&lw,
-    /* 0x24 */ &&lbu, &&lhu, &&lwr, &&inv,
-    /* 0x28 */ &&sb, &&sh, &&swl, &&sw,
-    /* 0x2c */ &&inv, &&inv, &&swr, &&cache,
-    /* 0x30 */ &&ll, &&inv, &&inv, &&pref,
-    /* 0x34 */ &&inv, &&inv, &&inv, &&inv,
-    /* 0x38 */ &&sc, &&inv, &&inv, &&inv,
-    /* 0x3c */ &&inv, &&inv, &&inv, &&inv,
-};
-
-/* clang-format on */
+#if CONFIG_FUSION
+#  define NR_FUSION_PAIRS 11
+#  define NR_SLOT_BRANCHES 8
+#endif
+
+#if CONFIG_ENGINE_TAILCALL
+/* defined after the handlers by instr-table.h */
+static const void *special_table[64], *special2_table[64], *special3_table[64];
+static const void *bshfl_table[64], *regimm_table[64];
+static const void *cop0_table_rs[32], *cop0_table_func[64], *opcode_table[64];
+#  if CONFIG_FPU
+static const void *cop1_table_rs[32], *cop1_table_s[64], *cop1_table_d[64];
+static const void *cop1_table_w[64];
+#  endif
+#  if CONFIG_FUSION
+static const void *fusion_table[NR_FUSION_PAIRS][3];
+#    if CONFIG_DELAYSLOT
+static const void *slot_branches[NR_SLOT_BRANCHES];
+#    endif
+#  endif
+#  if CONFIG_AOT
+static uint64_t tc_jit(decode_cache_t *decode, uint64_t n);
+#  endif
+#else
+#  include "instr-table.h"
+#endif
 #if CONFIG_DECODE_CACHE
 make_entry() {
   cpu.gpr[0] = 0;
 
-#  if CONFIG_DECODE_CACHE_PERF
-  decode_cache_hit += !!decode->handler;
-  decode_cache_miss += !decode->handler;
+#  if CONFIG_DECODE_CACHE_PERF || CONFIG_EXEC_VARIANTS
+  if (exec_has(DECODE_PERF)) {
+    decode_cache_hit += !!decode->handler;
+    decode_cache_miss += !decode->handler;
+  }
 #  endif
 
   if (decode->handler) {
-#  if CONFIG_INSTR_LOG
-    instr_enqueue_instr(decode->inst.val);
+#  if CONFIG_INSTR_LOG || CONFIG_EXEC_VARIANTS
+    if (exec_has(INSTR_LOG)) instr_enqueue_instr(decode->inst.val);
 #  endif
 
-#  if CONFIG_DECODE_CACHE_CHECK
-    assert(decode->inst.val == dbg_vaddr_read(cpu.pc, 4));
+#  if CONFIG_DECODE_CACHE_CHECK || CONFIG_EXEC_VARIANTS
+    if (exec_has(DECODE_CHECK))
+      assert(decode->inst.val == dbg_vaddr_read(cpu.pc, 4));
 #  endif
-    goto *(decode->handler);
+    dispatch(decode->handler);
   }
 
-  Inst inst = {.val = vaddr_read(cpu.pc, 4)};
-#  if CONFIG_INSTR_LOG || CONFIG_DECODE_CACHE_CHECK
+  Inst inst = {.val = instr_fetch(cpu.pc)};
+#  if CONFIG_INSTR_LOG || CONFIG_DECODE_CACHE_CHECK || CONFIG_BLOCK_CACHE || \
+      CONFIG_EXEC_VARIANTS
   decode->inst.val = inst.val;
 #  endif
-#  if CONFIG_INSTR_LOG
-  instr_enqueue_instr(decode->inst.val);
-#  endif
+  if (exec_has(INSTR_LOG)) instr_enqueue_instr(inst.val);
 
   unsigned op = inst.op;
   switch (op) {
@@ -220,6 +187,9 @@ make_entry() {
       goto Cop0Type;
     }
     break;
+#  if CONFIG_FPU
+  case 0x11: goto Cop1Type;
+#  endif
   case 0x1c: goto S2type;
   case 0x1f:
     if (inst.func == 0x20)
@@ -255,9 +225,33 @@ make_entry() {
     decode->rt = inst.rt;
     decode->rd = inst.rd;
     decode->sel = inst.sel;
+#  if CONFIG_MIPS32_R2
+    decode->func = inst.func; /* di and ei */
+#  endif
     decode->handler = cop0_table_rs[inst.rs];
     break;
   }
+#  if CONFIG_FPU
+  Cop1Type : {
+    decode->rs = inst.rs;
+    decode->rt = inst.rt;
+    if (inst.rs == 0x08) {
+      decode->simm = inst.simm;
+      decode->handler = cop1_table_rs[inst.rs];
+      break;
+    }
+    decode->rd = inst.rd;
+    decode->shamt = inst.shamt;
+    decode->func = inst.func;
+    switch (inst.rs) {
+    case 0x10: decode->handler = cop1_table_s[inst.func]; break;
+    case 0x11: decode->handler = cop1_table_d[inst.func]; break;
+    case 0x14: decode->handler = cop1_table_w[inst.func]; break;
+    default: decode->handler = cop1_table_rs[inst.rs]; break;
+    }
+    break;
+  }
+#  endif
   S2type : {
     decode->rs = inst.rs;
     decode->rt = inst.rt;
@@ -267,6 +261,12 @@ make_entry() {
     break;
   }
   S3Type : {
+#  if CONFIG_MIPS32_R2
+    decode->rs = inst.rs;
+    decode->rt = inst.rt;
+    decode->rd = inst.rd;
+    decode->shamt = inst.shamt;
+#  endif
     decode->handler = special3_table[inst.func];
     break;
   }
@@ -278,32 +278,94 @@ make_entry() {
   }
   } while (0);
 
+#  if CONFIG_AOT
+  /* translated code is not traced */
+  if (!exec_has(INSTR_LOG)) aot_install(decode, H(jit));
+#  endif
+
+#  if CONFIG_FUSION
+  /* pair the new instruction with its decoded neighbours,
+   * both halves of a pair live in the same page, a traced
+   * copy runs every instruction on its own */
+#    if CONFIG_DELAYSLOT
+  decode->slot_fused = false;
+#    endif
+  if (!exec_has(INSTR_LOG) && !decode_is_uncached(decode)) {
+    uint32_t idx = (cpu.pc & 0xFFF) >> 2;
+    decode_cache_t *first = idx > 0 ? decode - 1 : decode;
+    decode_cache_t *last = idx < DECODE_PAGE_INSTRS - 1 ? decode : decode - 1;
+    for (decode_cache_t *p = first; p <= last; p++) {
+      if (!p[0].handler || !p[1].handler) continue;
+      for (int i = 0; i < sizeof(fusion_table) / sizeof(*fusion_table); i++) {
+        if (p[0].handler == fusion_table[i][0] &&
+            p[1].handler == fusion_table[i][1]) {
+          p[0].handler = fusion_table[i][2];
+          break;
+        }
+      }
+#    if CONFIG_DELAYSLOT
+      for (int i = 0; i < sizeof(slot_branches) / sizeof(*slot_branches); i++)
+        if (p[0].handler == slot_branches[i]) p[0].slot_fused = true;
+#    endif
+    }
+  }
+#  endif
+
 Handler:
-  goto *(decode->handler);
+  dispatch(decode->handler);
 }
 #else
 make_entry() {
   cpu.gpr[0] = 0;
-#  if CONFIG_INSTR_LOG
-  instr_enqueue_instr(inst.val);
-#  endif
-  goto *opcode_table[inst.op];
+  if (exec_has(INSTR_LOG)) instr_enqueue_instr(inst.val);
+  dispatch(opcode_table[inst.op]);
 }
 #endif
 
 #if 1
-make_exec_handler(exec_special) { goto *special_table[operands->func]; }
-make_exec_handler(exec_special2) { goto *special2_table[operands->func]; }
-make_exec_handler(exec_special3) { goto *special3_table[operands->func]; }
-make_exec_handler(exec_bshfl) { goto *bshfl_table[operands->shamt]; }
+make_exec_handler(exec_special) { dispatch(special_table[operands->func]); }
+make_exec_handler(exec_special2) { dispatch(special2_table[operands->func]); }
+make_exec_handler(exec_special3) { dispatch(special3_table[operands->func]); }
+make_exec_handler(exec_bshfl) { dispatch(bshfl_table[operands->shamt]); }
 
-make_exec_handler(exec_regimm) { goto *regimm_table[operands->rt]; }
+make_exec_handler(exec_regimm) { dispatch(regimm_table[operands->rt]); }
 
 make_exec_handler(exec_cop0) {
   if (operands->rs & 0x10)
-    goto *cop0_table_func[operands->func];
+    dispatch(cop0_table_func[operands->func]);
   else
-    goto *cop0_table_rs[operands->rs];
+    dispatch(cop0_table_rs[operands->rs]);
+}
+
+#  if CONFIG_FPU
+make_exec_handler(exec_cop1) {
+  switch (operands->rs) {
+  case 0x10: dispatch(cop1_table_s[operands->func]);
+  case 0x11: dispatch(cop1_table_d[operands->func]);
+  case 0x14: dispatch(cop1_table_w[operands->func]);
+  default: dispatch(cop1_table_rs[operands->rs]);
+  }
+}
+#  endif
+#endif
+
+#if CONFIG_JIT || CONFIG_AOT
+make_exec_handler(jit) {
+#  if CONFIG_DELAYSLOT
+  if (cpu.is_delayslot) dispatch(decode->jit_handler);
+#  endif
+  if (n <= decode->jit_len) dispatch(decode->jit_handler);
+
+  vaddr_t pc = cpu.pc;
+  uint32_t ninstr = decode->jit_code();
+  if (cpu.has_exception) {
+    /* cpu.pc is the faulting instruction */
+    retire(ninstr);
+    goto exit;
+  }
+  cpu.pc = pc + ((ninstr - 1) << 2);
+  decode += ninstr - 1;
+  retire(ninstr - 1);
 }
 #endif
 
@@ -320,6 +382,7 @@ make_exec_handler(inv) {
       "...\n",
       cpu.pc, p[0], p[1], p[2], p[3]);
   nemu_state = NEMU_END;
+  cpu_kick();
 #endif
 }
 
@@ -330,22 +393,21 @@ make_exec_handler(tlbr) {
   uint32_t i = cpu.cp0.index.idx;
   CPUAssert(i < NR_TLB_ENTRY, "invalid tlb index\n");
   tlb_read(i);
+  update_mmu_ctx();
 }
 
 make_exec_handler(tlbwi) {
   uint32_t i = cpu.cp0.index.idx;
   CPUAssert(i < NR_TLB_ENTRY, "invalid tlb index %d (%d)\n", i, NR_TLB_ENTRY);
+  invalidate_tlb_entry(i);
   tlb_write(i);
-  clear_mmu_cache();
-  clear_decode_cache();
 }
 
 make_exec_handler(tlbwr) {
   uint32_t i = rand() % NR_TLB_ENTRY;
   cpu.cp0.random = i;
+  invalidate_tlb_entry(i);
   tlb_write(i);
-  clear_mmu_cache();
-  clear_decode_cache();
 }
 
 /* temporary strategy: store timer registers in C0 */
@@ -361,6 +423,7 @@ make_exec_handler(syscall) {
 make_exec_handler(breakpoint) {
   if (work_mode == MODE_GDB) {
     nemu_state = NEMU_STOP;
+    cpu_kick();
   } else {
     signal_exception(EXC_BP);
   }
@@ -368,11 +431,13 @@ make_exec_handler(breakpoint) {
 
 make_exec_handler(wait) {
   /* didn't +4 for pc */
+  cpu_wait();
   goto exit;
 }
 
 make_exec_handler(eret) {
   cpu.has_exception = true;
+  cpu.llbit = false;
 
 #if CONFIG_MARCH_MIPS32_R1
   if (cpu.cp0.status.ERL == 1) {
@@ -403,10 +468,11 @@ make_exec_handler(eret) {
 
 #if CONFIG_SEGMENT
   cpu.base = cpu.cp0.reserved[CP0_RESERVED_BASE];
+  clear_mmu_cache();
 #endif
 
-  clear_mmu_cache();
-  clear_decode_cache();
+  update_mmu_ctx();
+  intrs_changed(); /* EXL/ERL may be clear again */
 }
 
 #define CPRS(reg, sel) (((reg) << 3) | (sel))
@@ -414,9 +480,11 @@ make_exec_handler(eret) {
 make_exec_handler(mfc0) {
   /* used for nanos: pal and litenes */
   if (operands->rd == CP0_COUNT) {
-    cpu.gpr[operands->rt] = mips_get_count();
-    check_cp0_timer();
+    uint64_t count = mips_get_count();
+    cpu.gpr[operands->rt] = count;
+    nemu_timer_run(count);
   } else {
+    if (operands->rd == CP0_CAUSE) sync_cause_ip();
     cpu.gpr[operands->rt] = cpu.cp0.cpr[operands->rd][operands->sel];
   }
 }
@@ -424,11 +492,17 @@ make_exec_handler(mfc0) {
 make_exec_handler(mtc0) {
   switch (CPRS(operands->rd, operands->sel)) {
   case CPRS(CP0_EBASE, CP0_EBASE_SEL):
+    /* CPUNum is read only */
+    cpu.cp0.ebase = (cpu.gpr[operands->rt] & ~0x3FF) | (cpu.cp0.ebase & 0x3FF);
+    break;
   case CPRS(CP0_COUNT, 0):
   case CPRS(CP0_EPC, 0):
     cpu.cp0.cpr[operands->rd][operands->sel] = cpu.gpr[operands->rt];
     break;
   case CPRS(CP0_BADVADDR, 0): break;
+#if CONFIG_MIPS32_R2
+  case CPRS(CP0_STATUS, CP0_INTCTL_SEL): break; /* IPTI and IPPCI are fixed */
+#endif
   case CPRS(CP0_CONTEXT, 0): {
     cp0_context_t *newVal = (void *)&(cpu.gpr[operands->rt]);
     cpu.cp0.context.PTEBase = newVal->PTEBase;
@@ -439,10 +513,6 @@ make_exec_handler(mtc0) {
   } break;
   case CPRS(CP0_STATUS, 0): {
     cp0_status_t *newVal = (void *)&(cpu.gpr[operands->rt]);
-    if (cpu.cp0.status.ERL != newVal->ERL) {
-      clear_decode_cache();
-      clear_mmu_cache();
-    }
     cpu.cp0.status.CU = newVal->CU;
     cpu.cp0.status.RP = newVal->RP;
     cpu.cp0.status.RE = newVal->RE;
@@ -457,11 +527,13 @@ make_exec_handler(mtc0) {
     cpu.cp0.status.ERL = newVal->ERL;
     cpu.cp0.status.EXL = newVal->EXL;
     cpu.cp0.status.IE = newVal->IE;
+    update_mmu_ctx();
+    intrs_changed();
   } break;
   case CPRS(CP0_COMPARE, 0):
     cpu.cp0.compare = cpu.gpr[operands->rt];
     update_interrupt_deadline();
-    nemu_set_irq(7, 0);
+    cpu_set_irq(cpu_current_id(), 7, 0);
     break;
   case CPRS(CP0_CAUSE, 0): {
     uint32_t sw_ip_mask = 3;
@@ -472,6 +544,7 @@ make_exec_handler(mtc0) {
     cpu.cp0.cause.WP = newVal->WP;
     cpu.cp0.cause.IP =
         (newVal->IP & sw_ip_mask) | (cpu.cp0.cause.IP & ~sw_ip_mask);
+    intrs_changed();
   } break;
   case CPRS(CP0_PAGEMASK, 0): {
     cp0_pagemask_t *newVal = (void *)&(cpu.gpr[operands->rt]);
@@ -494,12 +567,22 @@ make_exec_handler(mtc0) {
     cpu.cp0.entry_lo1.c = newVal->c;
     cpu.cp0.entry_lo1.pfn = newVal->pfn;
   } break;
+#if CONFIG_PAGE_WALKER
+  case CPRS(CP0_PAGEMASK, CP0_PWBASE_SEL):
+  case CPRS(CP0_PAGEMASK, CP0_PWFIELD_SEL):
+  case CPRS(CP0_PAGEMASK, CP0_PWSIZE_SEL):
+    cpu.cp0.cpr[operands->rd][operands->sel] = cpu.gpr[operands->rt];
+    break;
+  case CPRS(CP0_WIRED, CP0_PWCTL_SEL): {
+    cp0_pwctl_t *newVal = (void *)&(cpu.gpr[operands->rt]);
+    cpu.cp0.pwctl.PWEn = newVal->PWEn;
+  } break;
+#endif
   case CPRS(CP0_ENTRY_HI, 0): {
     cp0_entry_hi_t *newVal = (void *)&(cpu.gpr[operands->rt]);
     cpu.cp0.entry_hi.asid = newVal->asid;
     cpu.cp0.entry_hi.vpn = newVal->vpn;
-    clear_mmu_cache();
-    clear_decode_cache();
+    update_mmu_ctx();
   } break;
   case CPRS(CP0_INDEX, 0): {
     cpu.cp0.index.idx = cpu.gpr[operands->rt];
@@ -553,6 +636,21 @@ make_exec_handler(mtc0) {
   }
 }
 
+#if CONFIG_MIPS32_R2
+/* di and ei, sc is bit 5 of func */
+make_exec_handler(mfmc0) {
+  cpu.gpr[operands->rt] = cpu.cp0.cpr[CP0_STATUS][0];
+  cpu.cp0.status.IE = (operands->func >> 5) & 1;
+  intrs_changed();
+}
+
+/* there are no shadow register sets, SRSCtl.PSS is always
+ * the current set */
+make_exec_handler(rdpgpr) { cpu.gpr[operands->rd] = cpu.gpr[operands->rt]; }
+
+make_exec_handler(wrpgpr) { cpu.gpr[operands->rd] = cpu.gpr[operands->rt]; }
+#endif
+
 make_exec_handler(teq) {
   if ((int32_t)cpu.gpr[operands->rs] == (int32_t)cpu.gpr[operands->rt]) {
     signal_exception(EXC_TRAP);
@@ -778,12 +876,32 @@ make_exec_handler(srav) {
       (int32_t)cpu.gpr[operands->rt] >> (cpu.gpr[operands->rs] & 0x1f);
 }
 
+#if CONFIG_MIPS32_R2
+/* rotr and rotrv are srl and srlv with rs and shamt 1 */
+#  define ror32(v, n) (((v) >> (n)) | ((v) << ((32 - (n)) & 0x1f)))
+
+make_exec_handler(rotr) {
+  cpu.gpr[operands->rd] = ror32(cpu.gpr[operands->rt], operands->shamt);
+}
+
+make_exec_handler(rotrv) {
+  uint32_t sa = cpu.gpr[operands->rs] & 0x1f;
+  cpu.gpr[operands->rd] = ror32(cpu.gpr[operands->rt], sa);
+}
+#endif
+
 make_exec_handler(srl) {
+#if CONFIG_MIPS32_R2
+  if (operands->rs == 1) dispatch(H(rotr));
+#endif
   InstAssert(operands->rs == 0);
   cpu.gpr[operands->rd] = cpu.gpr[operands->rt] >> operands->shamt;
 }
 
 make_exec_handler(srlv) {
+#if CONFIG_MIPS32_R2
+  if (operands->shamt == 1) dispatch(H(rotrv));
+#endif
   InstAssert(operands->shamt == 0);
   cpu.gpr[operands->rd] =
       cpu.gpr[operands->rt] >> (cpu.gpr[operands->rs] & 0x1f);
@@ -990,16 +1108,20 @@ make_exec_handler(pref) {}
 
 make_exec_handler(ll) {
   CHECK_ALIGNED_ADDR_AdEL(4, cpu.gpr[operands->rs] + operands->simm);
-  cpu.gpr[operands->rt] = vaddr_read(cpu.gpr[operands->rs] + operands->simm, 4);
+  uint32_t rdata = load_linked(cpu.gpr[operands->rs] + operands->simm);
+  if (!cpu.has_exception) { cpu.gpr[operands->rt] = rdata; }
 }
 
 make_exec_handler(sc) {
   CHECK_ALIGNED_ADDR_AdES(4, cpu.gpr[operands->rs] + operands->simm);
-  vaddr_write(cpu.gpr[operands->rs] + operands->simm, 4, cpu.gpr[operands->rt]);
-  if (!cpu.has_exception) cpu.gpr[operands->rt] = 1;
+  bool ok = store_conditional(
+      cpu.gpr[operands->rs] + operands->simm, cpu.gpr[operands->rt]);
+  if (!cpu.has_exception) cpu.gpr[operands->rt] = ok;
 }
 
-make_exec_handler(cache) { clear_decode_cache(); }
+make_exec_handler(cache) {
+  cache_op(operands->rt, cpu.gpr[operands->rs] + operands->simm);
+}
 
 make_exec_handler(sync) {}
 
@@ -1162,19 +1284,20 @@ make_exec_handler(bltzal) {
 make_exec_handler(jal) {
   cpu.gpr[31] = cpu.pc + 8;
   cpu.br_target = (cpu.pc & 0xf0000000) | (operands->addr << 2);
-#if CONFIG_FUNCTION_TRACE_LOG
-  frames_enqueue_call(cpu.pc, cpu.br_target);
-#endif
+  if (exec_has(FUNCTION_TRACE)) frames_enqueue_call(cpu.pc, cpu.br_target);
   prepare_delayslot();
 }
 
 make_exec_handler(jalr) {
+#if CONFIG_MIPS32_R2
+  /* jalr.hb, hazards are always cleared here */
+  InstAssert(operands->rt == 0 && (operands->shamt & ~0x10) == 0);
+#else
   InstAssert(operands->rt == 0 && operands->shamt == 0);
+#endif
   cpu.gpr[operands->rd] = cpu.pc + 8;
   cpu.br_target = cpu.gpr[operands->rs];
-#if CONFIG_FUNCTION_TRACE_LOG
-  frames_enqueue_call(cpu.pc, cpu.br_target);
-#endif
+  if (exec_has(FUNCTION_TRACE)) frames_enqueue_call(cpu.pc, cpu.br_target);
   prepare_delayslot();
 }
 
@@ -1186,9 +1309,8 @@ make_exec_handler(j) {
 make_exec_handler(jr) {
   InstAssert(operands->rt == 0 && operands->rd == 0);
   cpu.br_target = cpu.gpr[operands->rs];
-#if CONFIG_FUNCTION_TRACE_LOG
-  if (operands->rs == R_ra) frames_enqueue_ret(cpu.pc, cpu.br_target);
-#endif
+  if (exec_has(FUNCTION_TRACE) && operands->rs == R_ra)
+    frames_enqueue_ret(cpu.pc, cpu.br_target);
   prepare_delayslot();
 }
 
@@ -1200,21 +1322,345 @@ make_exec_handler(seh) {
   cpu.gpr[operands->rd] = (int32_t)(int16_t)cpu.gpr[operands->rt];
 }
 
-#if CONFIG_DELAYSLOT
-make_label(inst_end) {
-  if (cpu.is_delayslot) {
-    cpu.pc = cpu.br_target;
-    cpu.is_delayslot = false;
-  } else {
+#if CONFIG_MIPS32_R2
+make_exec_handler(wsbh) {
+  uint32_t rt = cpu.gpr[operands->rt];
+  cpu.gpr[operands->rd] = ((rt & 0x00FF00FF) << 8) | ((rt >> 8) & 0x00FF00FF);
+}
+
+/* lsb sits in shamt, msbd (ext) or msb (ins) in rd */
+make_exec_handler(ext) {
+  InstAssert(operands->shamt + operands->rd < 32);
+  uint32_t mask = 0xFFFFFFFFu >> (31 - operands->rd);
+  cpu.gpr[operands->rt] = (cpu.gpr[operands->rs] >> operands->shamt) & mask;
+}
+
+make_exec_handler(ins) {
+  InstAssert(operands->rd >= operands->shamt);
+  uint32_t mask = 0xFFFFFFFFu >> (31 - (operands->rd - operands->shamt));
+  uint32_t rt = cpu.gpr[operands->rt] & ~(mask << operands->shamt);
+  uint32_t rs = (cpu.gpr[operands->rs] & mask) << operands->shamt;
+  cpu.gpr[operands->rt] = rt | rs;
+}
+
+/* HWREna is not modelled, every register reads in user
+ * mode and the rest, UserLocal among them, trap to the
+ * kernel to be emulated */
+make_exec_handler(rdhwr) {
+  switch (operands->rd) {
+  case 0: cpu.gpr[operands->rt] = cpu_current_id(); break;
+  case 1: cpu.gpr[operands->rt] = 16; break; /* SYNCI_Step */
+  case 2: cpu.gpr[operands->rt] = mips_get_count(); break;
+  case 3: cpu.gpr[operands->rt] = 1; break; /* CCRes */
+  default: InstAssert(0); break;
+  }
+}
+
+/* caches are not modelled */
+make_exec_handler(synci) {}
+#endif
+
+#if CONFIG_FPU
+//////////////////////////////////////////////////////////////
+//                      cp1, the fpu                        //
+//////////////////////////////////////////////////////////////
+/* fd, fs and ft sit in shamt, rd and rt */
+#  define fpr_s(i) cpu.fpr.s[i]
+#  define fpr_d(i) cpu.fpr.d[(i) >> 1]
+#  define fpr_w(i) cpu.fpr.w[i]
+#  define fpu_nan_w(v) (v)
+
+#  define check_fpu_usable()         \
+    if (!(cpu.cp0.status.CU & 0x2)) { \
+      cpu.cp0.cause.CE = 1;          \
+      signal_exception(EXC_CPU);     \
+      goto exit;                     \
+    }
+
+/* an operation computing res, which is dropped if it traps */
+#  define fpu_begin()  \
+    check_fpu_usable(); \
+    fpu_enter()
+#  define fpu_end(res)                \
+    __asm__ volatile("" : "+m"(res)); \
+    if (fpu_trapped()) goto exit
+
+#  define fpu_op(fmt, expr)                             \
+    do {                                                \
+      fpu_begin();                                      \
+      __typeof__(fpr_##fmt(0)) res = (expr);            \
+      fpu_end(res);                                     \
+      fpr_##fmt(operands->shamt) = fpu_nan_##fmt(res); \
+    } while (0)
+
+/* c.cond.fmt, cond is the low four bits of func, the
+ * highest one makes an unordered compare raise invalid */
+#  define fpu_compare(fmt)                                               \
+    do {                                                                 \
+      fpu_begin();                                                       \
+      __typeof__(fpr_##fmt(0)) a = fpr_##fmt(operands->rd);              \
+      __typeof__(fpr_##fmt(0)) b = fpr_##fmt(operands->rt);              \
+      int cond = operands->func & 0xF;                                   \
+      bool res = __builtin_isunordered(a, b);                            \
+      if (res && (cond & 0x8)) feraiseexcept(FE_INVALID);               \
+      res = (res && (cond & 0x1)) || ((cond & 0x2) && a == b) ||        \
+            ((cond & 0x4) && __builtin_isless(a, b));                    \
+      fpu_end(res);                                                      \
+      fpu_set_fcc(operands->shamt >> 2, res);                            \
+    } while (0)
+
+#  define make_fpu_handlers(name, expr_s, expr_d)          \
+    make_exec_handler(name##_s) { fpu_op(s, expr_s); }     \
+    make_exec_handler(name##_d) { fpu_op(d, expr_d); }
+
+#  define fs_s fpr_s(operands->rd)
+#  define ft_s fpr_s(operands->rt)
+#  define fs_d fpr_d(operands->rd)
+#  define ft_d fpr_d(operands->rt)
+
+make_fpu_handlers(add, fs_s + ft_s, fs_d + ft_d);
+make_fpu_handlers(sub, fs_s - ft_s, fs_d - ft_d);
+make_fpu_handlers(mul, fs_s * ft_s, fs_d * ft_d);
+make_fpu_handlers(div, fs_s / ft_s, fs_d / ft_d);
+make_fpu_handlers(sqrt, sqrtf(fs_s), sqrt(fs_d));
+
+make_exec_handler(c_s) { fpu_compare(s); }
+make_exec_handler(c_d) { fpu_compare(d); }
+
+make_exec_handler(cvt_s_d) { fpu_op(s, (float)fs_d); }
+make_exec_handler(cvt_s_w) {
+  fpu_op(s, (float)(int32_t)fpr_w(operands->rd));
+}
+make_exec_handler(cvt_d_s) { fpu_op(d, fs_s); }
+make_exec_handler(cvt_d_w) { fpu_op(d, (int32_t)fpr_w(operands->rd)); }
+
+/* cvt.w follows FCSR.RM, the others round as they say */
+#  define make_fpu_to_w(name, round)                                 \
+    make_exec_handler(name##_s) {                                    \
+      fpu_op(w, fpu_to_w(fs_s, round((double)fs_s)));               \
+    }                                                                \
+    make_exec_handler(name##_d) { fpu_op(w, fpu_to_w(fs_d, round(fs_d))); }
+
+make_fpu_to_w(cvt_w, nearbyint);
+make_fpu_to_w(round_w, __builtin_roundeven);
+make_fpu_to_w(trunc_w, trunc);
+make_fpu_to_w(ceil_w, ceil);
+make_fpu_to_w(floor_w, floor);
+
+/* sign and moves only touch bits, as with abs2008 */
+make_exec_handler(abs_s) {
+  check_fpu_usable();
+  fpr_w(operands->shamt) = fpr_w(operands->rd) & 0x7FFFFFFF;
+}
+
+make_exec_handler(abs_d) {
+  check_fpu_usable();
+  fpr_w(operands->shamt & ~1) = fpr_w(operands->rd & ~1);
+  fpr_w(operands->shamt | 1) = fpr_w(operands->rd | 1) & 0x7FFFFFFF;
+}
+
+make_exec_handler(neg_s) {
+  check_fpu_usable();
+  fpr_w(operands->shamt) = fpr_w(operands->rd) ^ 0x80000000;
+}
+
+make_exec_handler(neg_d) {
+  check_fpu_usable();
+  fpr_w(operands->shamt & ~1) = fpr_w(operands->rd & ~1);
+  fpr_w(operands->shamt | 1) = fpr_w(operands->rd | 1) ^ 0x80000000;
+}
+
+#  define fpu_move_if(fmt, cond)                      \
+    check_fpu_usable();                               \
+    if (cond) fpr_##fmt(operands->shamt) = fs_##fmt
+
+make_exec_handler(mov_s) { fpu_move_if(s, true); }
+make_exec_handler(mov_d) { fpu_move_if(d, true); }
+make_exec_handler(movz_s) { fpu_move_if(s, cpu.gpr[operands->rt] == 0); }
+make_exec_handler(movz_d) { fpu_move_if(d, cpu.gpr[operands->rt] == 0); }
+make_exec_handler(movn_s) { fpu_move_if(s, cpu.gpr[operands->rt] != 0); }
+make_exec_handler(movn_d) { fpu_move_if(d, cpu.gpr[operands->rt] != 0); }
+
+/* movf.fmt and movt.fmt, cc and tf sit in rt */
+#  define fpu_fcc_matches() \
+    (fpu_fcc(operands->rt >> 2) == (operands->rt & 1))
+
+make_exec_handler(movcf_s) { fpu_move_if(s, fpu_fcc_matches()); }
+make_exec_handler(movcf_d) { fpu_move_if(d, fpu_fcc_matches()); }
+
+make_exec_handler(movci) {
+  check_fpu_usable();
+  if (fpu_fcc_matches()) cpu.gpr[operands->rd] = cpu.gpr[operands->rs];
+}
+
+make_exec_handler(fpu_unimpl) {
+  check_fpu_usable();
+  fpu_unimplemented();
+}
+
+make_exec_handler(mfc1) {
+  check_fpu_usable();
+  cpu.gpr[operands->rt] = fpr_w(operands->rd);
+}
+
+make_exec_handler(mtc1) {
+  check_fpu_usable();
+  fpr_w(operands->rd) = cpu.gpr[operands->rt];
+}
+
+#  if CONFIG_MIPS32_R2
+/* the high word of a double, the odd one of the pair */
+make_exec_handler(mfhc1) {
+  check_fpu_usable();
+  cpu.gpr[operands->rt] = fpr_w(operands->rd | 1);
+}
+
+make_exec_handler(mthc1) {
+  check_fpu_usable();
+  fpr_w(operands->rd | 1) = cpu.gpr[operands->rt];
+}
+#  endif
+
+make_exec_handler(cfc1) {
+  check_fpu_usable();
+  switch (operands->rd) {
+  case FPU_FIR: cpu.gpr[operands->rt] = 0x00030000; break; /* D, S */
+  case FPU_FCSR: cpu.gpr[operands->rt] = cpu.fcsr; break;
+  default: cpu.gpr[operands->rt] = 0; break;
+  }
+}
+
+make_exec_handler(ctc1) {
+  check_fpu_usable();
+  if (operands->rd == FPU_FCSR) {
+    fpu_set_fcsr(cpu.gpr[operands->rt]);
+    /* a cause written along with its enable traps at once */
+    uint32_t cause = (cpu.fcsr >> FCSR_CAUSE_SHIFT) & 0x3F;
+    uint32_t enables = (cpu.fcsr >> FCSR_ENABLES_SHIFT) & 0x1F;
+    if (cause & (enables | 0x20)) {
+      signal_exception(EXC_FPE);
+      goto exit;
+    }
+  }
+}
+
+/* bc1f, bc1t, bc1fl and bc1tl, nd is bit 1 of rt */
+make_exec_handler(bc1) {
+  check_fpu_usable();
+  if (fpu_fcc_matches()) {
+    cpu.br_target = cpu.pc + (operands->simm << 2) + 4;
+    prepare_delayslot();
+  } else if (operands->rt & 0x2) {
+    cpu.br_target = cpu.pc + 8;
     cpu.pc += 4;
+  } else {
+    cpu.br_target = cpu.pc + 8;
+    prepare_delayslot();
   }
-  /* fall through */
 }
+
+make_exec_handler(lwc1) {
+  check_fpu_usable();
+  CHECK_ALIGNED_ADDR_AdEL(4, cpu.gpr[operands->rs] + operands->simm);
+  uint32_t rdata = vaddr_read(cpu.gpr[operands->rs] + operands->simm, 4);
+  if (!cpu.has_exception) { fpr_w(operands->rt) = rdata; }
+}
+
+make_exec_handler(swc1) {
+  check_fpu_usable();
+  CHECK_ALIGNED_ADDR_AdES(4, cpu.gpr[operands->rs] + operands->simm);
+  vaddr_write(
+      cpu.gpr[operands->rs] + operands->simm, 4, fpr_w(operands->rt));
+}
+
+/* the even register holds the low word */
+make_exec_handler(ldc1) {
+  check_fpu_usable();
+  vaddr_t addr = cpu.gpr[operands->rs] + operands->simm;
+  CHECK_ALIGNED_ADDR_AdEL(8, addr);
+  uint32_t lo = vaddr_read(addr, 4);
+  if (cpu.has_exception) goto exit;
+  uint32_t hi = vaddr_read(addr + 4, 4);
+  if (cpu.has_exception) goto exit;
+  fpr_w(operands->rt & ~1) = lo;
+  fpr_w(operands->rt | 1) = hi;
+}
+
+make_exec_handler(sdc1) {
+  check_fpu_usable();
+  vaddr_t addr = cpu.gpr[operands->rs] + operands->simm;
+  CHECK_ALIGNED_ADDR_AdES(8, addr);
+  vaddr_write(addr, 4, fpr_w(operands->rt & ~1));
+  if (cpu.has_exception) goto exit;
+  vaddr_write(addr + 4, 4, fpr_w(operands->rt | 1));
+}
+#endif
+
+#if CONFIG_FUSION
+/* the first half of a fused pair runs here and the second
+ * one through its own handler, the pair is split again when
+ * the first half sits in a delay slot or only one more
+ * instruction may run */
+#  if CONFIG_DELAYSLOT
+#    define fused_pair_ready() (!cpu.is_delayslot && n >= 2)
+#  else
+#    define fused_pair_ready() (n >= 2)
+#  endif
+
+#  define make_fused_handler(first, second, ...) \
+    make_exec_handler(first##_##second) {        \
+      if (!fused_pair_ready()) dispatch(H(first)); \
+      __VA_ARGS__;                               \
+      cpu.gpr[0] = 0;                            \
+      cpu.pc += 4;                               \
+      decode++;                                  \
+      retire(1);                                 \
+      dispatch(H(second));                       \
+    }
+
+#  define fused_lui()              \
+    InstAssert(operands->rs == 0); \
+    cpu.gpr[operands->rt] = operands->uimm << 16
+#  define fused_slt()                  \
+    InstAssert(operands->shamt == 0);  \
+    cpu.gpr[operands->rd] =            \
+        (int32_t)cpu.gpr[operands->rs] < (int32_t)cpu.gpr[operands->rt]
+#  define fused_sltu()                 \
+    InstAssert(operands->shamt == 0);  \
+    cpu.gpr[operands->rd] = cpu.gpr[operands->rs] < cpu.gpr[operands->rt]
+#  define fused_slti() \
+    cpu.gpr[operands->rt] = (int32_t)cpu.gpr[operands->rs] < operands->simm
+#  define fused_sltiu() \
+    cpu.gpr[operands->rt] = cpu.gpr[operands->rs] < operands->simm
+
+make_fused_handler(lui, addiu, fused_lui());
+make_fused_handler(lui, ori, fused_lui());
+make_fused_handler(lui, lw, fused_lui());
+make_fused_handler(slt, beq, fused_slt());
+make_fused_handler(slt, bne, fused_slt());
+make_fused_handler(sltu, beq, fused_sltu());
+make_fused_handler(sltu, bne, fused_sltu());
+make_fused_handler(slti, beq, fused_slti());
+make_fused_handler(slti, bne, fused_slti());
+make_fused_handler(sltiu, beq, fused_sltiu());
+make_fused_handler(sltiu, bne, fused_sltiu());
 #endif
 
+#if CONFIG_ENGINE_TAILCALL
+  tc_epilogue();
+}
+#else
+#  if CONFIG_DELAYSLOT
+make_label(inst_end) {
+  advance_pc();
+  /* fall through */
+}
+#  endif
+
 make_exit() {
-#if 0
+#  if 0
   if (cpu.gpr[0] != 0)
     eprintf("%08x: set zero to %08x\n", get_current_pc(), cpu.gpr[0]);
-#endif
+#  endif
 }
+#endif
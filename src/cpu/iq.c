@@ -25,14 +25,14 @@ void instr_enqueue_instr(uint32_t instr) {
 }
 
 uint32_t get_current_pc() {
-#if !CONFIG_INSTR_LOG
+#if !CONFIG_INSTR_LOG && !CONFIG_EXEC_VARIANTS
   panic("CONFIG_INSTR_LOG is needed for get_current_pc\n");
 #endif
   return iq[instr_ptr].pc;
 }
 
 uint32_t get_current_instr() {
-#if !CONFIG_INSTR_LOG
+#if !CONFIG_INSTR_LOG && !CONFIG_EXEC_VARIANTS
   panic("CONFIG_INSTR_LOG is needed for get_current_instr\n");
 #endif
   if (iq[instr_ptr].instr_enq) return iq[instr_ptr].instr;
@@ -0,0 +1,412 @@
+#if CONFIG_JIT
+
+#  if !defined(__x86_64__)
+#    error "CONFIG_JIT only supports x86-64 hosts"
+#  endif
+
+#  include <stddef.h>
+#  include <sys/mman.h>
+
+#  include "common.h"
+#  include "jit.h"
+
+/* A straight-line run of guest instructions is compiled
+ * into one host function. Architectural state stays in
+ * `cpu', %rbx holds its address during the run, so every
+ * guest register access is a [%rbx + disp32] operand.
+ *
+ * Memory accesses call back into cpu.c, cpu.pc is advanced
+ * to the accessing instruction before the call so that
+ * signal_exception() sees the right epc. The code does not
+ * depend on the virtual address it runs at, a physical page
+ * may be mapped at several.
+ */
+
+#  define JIT_CODE_SIZE (16 * 1024 * 1024)
+#  define JIT_MAX_INSTR_SIZE 80
+
+enum { EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESI = 6, EDI = 7 };
+
+static uint8_t *jit_buf = NULL;
+static uint8_t *jit_ptr = NULL;
+static int jit_pc_index; /* instruction cpu.pc points to */
+
+#  define GPR(r) (offsetof(CPU_state, gpr) + 4 * (r))
+#  define HI offsetof(CPU_state, hi)
+#  define LO offsetof(CPU_state, lo)
+#  define PC offsetof(CPU_state, pc)
+#  define HAS_EXCEPTION offsetof(CPU_state, has_exception)
+
+static inline void emit1(uint8_t v) { *jit_ptr++ = v; }
+
+static inline void emit4(uint32_t v) {
+  memcpy(jit_ptr, &v, 4);
+  jit_ptr += 4;
+}
+
+static inline void emit8(uint64_t v) {
+  memcpy(jit_ptr, &v, 8);
+  jit_ptr += 8;
+}
+
+/* mov reg, [rbx + off] */
+static void emit_load(int reg, uint32_t off) {
+  emit1(0x8B);
+  emit1(0x80 | (reg << 3) | EBX);
+  emit4(off);
+}
+
+/* mov [rbx + off], reg */
+static void emit_store(int reg, uint32_t off) {
+  emit1(0x89);
+  emit1(0x80 | (reg << 3) | EBX);
+  emit4(off);
+}
+
+static void emit_load_gpr(int reg, int r) {
+  if (r == 0) {
+    emit1(0x31); /* xor reg, reg */
+    emit1(0xC0 | (reg << 3) | reg);
+  } else {
+    emit_load(reg, GPR(r));
+  }
+}
+
+/* mov reg, imm32 */
+static void emit_mov_imm(int reg, uint32_t imm) {
+  emit1(0xB8 + reg);
+  emit4(imm);
+}
+
+/* op eax, ecx */
+static void emit_alu_rr(uint8_t opcode) {
+  emit1(opcode);
+  emit1(0xC0 | (ECX << 3) | EAX);
+}
+
+/* op eax, imm32, for add/or/and/xor/cmp */
+static void emit_alu_imm(uint8_t opcode, uint32_t imm) {
+  emit1(opcode);
+  emit4(imm);
+}
+
+/* setcc al; movzx eax, al */
+static void emit_setcc(uint8_t cc) {
+  emit1(0x0F);
+  emit1(cc);
+  emit1(0xC0);
+  emit1(0x0F);
+  emit1(0xB6);
+  emit1(0xC0);
+}
+
+/* shl/shr/sar eax, imm8 or cl */
+static void emit_shift(int ext, bool by_cl, uint8_t sa) {
+  emit1(by_cl ? 0xD3 : 0xC1);
+  emit1(0xC0 | (ext << 3) | EAX);
+  if (!by_cl) emit1(sa);
+}
+
+static void emit_epilogue(uint32_t ninstr) {
+  emit_mov_imm(EAX, ninstr);
+  emit1(0x5B); /* pop rbx */
+  emit1(0xC3); /* ret */
+}
+
+/* advance pc to instruction k, call helper, leave with k
+ * retired instructions if the helper signals an exception */
+static void emit_helper_call(int k, void *helper) {
+  if (k != jit_pc_index) {
+    emit1(0x81); /* add dword [rbx + PC], imm32 */
+    emit1(0x80 | EBX);
+    emit4(PC);
+    emit4((k - jit_pc_index) << 2);
+    jit_pc_index = k;
+  }
+
+  emit1(0x48); /* movabs rax, helper; call rax */
+  emit1(0xB8);
+  emit8((uintptr_t)helper);
+  emit1(0xFF);
+  emit1(0xD0);
+
+  emit1(0x80); /* cmp byte [rbx + HAS_EXCEPTION], 0 */
+  emit1(0xB8 | EBX);
+  emit4(HAS_EXCEPTION);
+  emit1(0x00);
+  emit1(0x74); /* je over the early epilogue */
+  emit1(0x07);
+  emit_epilogue(k);
+}
+
+/* compute rs + simm into edi */
+static void emit_addr(Inst inst) {
+  emit_load_gpr(EAX, inst.rs);
+  if (inst.simm != 0) emit_alu_imm(0x05, (int32_t)inst.simm);
+  emit1(0x89); /* mov edi, eax */
+  emit1(0xC0 | (EAX << 3) | EDI);
+}
+
+static void emit_special(Inst inst) {
+  int rd = inst.rd;
+  switch (inst.func) {
+  case 0x00: /* sll */
+  case 0x02: /* srl */
+  case 0x03: /* sra */
+    if (rd == 0) return;
+    emit_load_gpr(EAX, inst.rt);
+    /* rotr is srl with rs 1 */
+    emit_shift(inst.func == 0x00 ? 4 : inst.func == 0x03 ? 7 : inst.rs ? 1 : 5,
+        false, inst.shamt);
+    break;
+  case 0x04: /* sllv */
+  case 0x06: /* srlv */
+  case 0x07: /* srav */
+    if (rd == 0) return;
+    emit_load_gpr(EAX, inst.rt);
+    emit_load_gpr(ECX, inst.rs);
+    /* rotrv is srlv with shamt 1 */
+    emit_shift(
+        inst.func == 0x04 ? 4 : inst.func == 0x07 ? 7 : inst.shamt ? 1 : 5,
+        true, 0);
+    break;
+  case 0x0a: /* movz */
+  case 0x0b: /* movn */
+    if (rd == 0) return;
+    emit_load_gpr(ECX, inst.rt);
+    emit1(0x85); /* test ecx, ecx */
+    emit1(0xC0 | (ECX << 3) | ECX);
+    emit1(inst.func == 0x0a ? 0x75 : 0x74); /* jnz/jz over the move */
+    emit1(inst.rs == 0 ? 8 : 12);
+    emit_load_gpr(EAX, inst.rs);
+    break;
+  case 0x10: /* mfhi */
+  case 0x12: /* mflo */
+    if (rd == 0) return;
+    emit_load(EAX, inst.func == 0x10 ? HI : LO);
+    break;
+  case 0x11: /* mthi */
+  case 0x13: /* mtlo */
+    emit_load_gpr(EAX, inst.rs);
+    emit_store(EAX, inst.func == 0x11 ? HI : LO);
+    return;
+  case 0x18: /* mult */
+  case 0x19: /* multu */
+    emit_load_gpr(EAX, inst.rs);
+    emit_load_gpr(ECX, inst.rt);
+    emit1(0xF7); /* imul ecx / mul ecx */
+    emit1(0xC0 | ((inst.func == 0x18 ? 5 : 4) << 3) | ECX);
+    emit_store(EAX, LO);
+    emit_store(EDX, HI);
+    return;
+  default: /* addu, subu, and, or, xor, nor, slt, sltu */
+    if (rd == 0) return;
+    emit_load_gpr(EAX, inst.rs);
+    emit_load_gpr(ECX, inst.rt);
+    switch (inst.func) {
+    case 0x21: emit_alu_rr(0x01); break;
+    case 0x23: emit_alu_rr(0x29); break;
+    case 0x24: emit_alu_rr(0x21); break;
+    case 0x25: emit_alu_rr(0x09); break;
+    case 0x26: emit_alu_rr(0x31); break;
+    case 0x27:
+      emit_alu_rr(0x09);
+      emit1(0xF7); /* not eax */
+      emit1(0xD0);
+      break;
+    case 0x2a:
+    case 0x2b:
+      emit_alu_rr(0x39); /* cmp eax, ecx */
+      emit_setcc(inst.func == 0x2a ? 0x9C : 0x92);
+      break;
+    }
+    break;
+  }
+  emit_store(EAX, GPR(rd));
+}
+
+static void emit_inst(Inst inst, int k) {
+  int rt = inst.rt;
+  switch (inst.op) {
+  case 0x00: emit_special(inst); return;
+  case 0x09: /* addiu */
+  case 0x0a: /* slti */
+  case 0x0b: /* sltiu */
+  case 0x0c: /* andi */
+  case 0x0d: /* ori */
+  case 0x0e: /* xori */
+    if (rt == 0) return;
+    emit_load_gpr(EAX, inst.rs);
+    switch (inst.op) {
+    case 0x09: emit_alu_imm(0x05, (int32_t)inst.simm); break;
+    case 0x0a:
+    case 0x0b:
+      emit_alu_imm(0x3D, (int32_t)inst.simm);
+      emit_setcc(inst.op == 0x0a ? 0x9C : 0x92);
+      break;
+    case 0x0c: emit_alu_imm(0x25, inst.uimm); break;
+    case 0x0d: emit_alu_imm(0x0D, inst.uimm); break;
+    case 0x0e: emit_alu_imm(0x35, inst.uimm); break;
+    }
+    break;
+  case 0x0f: /* lui */
+    if (rt == 0) return;
+    emit_mov_imm(EAX, inst.uimm << 16);
+    break;
+  case 0x1c: /* mul */
+    if (inst.rd == 0) return;
+    emit_load_gpr(EAX, inst.rs);
+    emit_load_gpr(ECX, rt);
+    emit1(0x0F); /* imul eax, ecx */
+    emit1(0xAF);
+    emit1(0xC0 | (EAX << 3) | ECX);
+    emit_store(EAX, GPR(inst.rd));
+    return;
+  case 0x1f: /* seb, seh, ext */
+    if (inst.func == 0x00) {
+      if (rt == 0) return;
+      emit_load_gpr(EAX, inst.rs);
+      emit_shift(5, false, inst.shamt);
+      emit_alu_imm(0x25, 0xFFFFFFFFu >> (31 - inst.rd));
+      break;
+    }
+    if (inst.rd == 0) return;
+    emit_load_gpr(EAX, rt);
+    emit1(0x0F); /* movsx eax, al/ax */
+    emit1(inst.shamt == 0x10 ? 0xBE : 0xBF);
+    emit1(0xC0);
+    emit_store(EAX, GPR(inst.rd));
+    return;
+  case 0x20: /* lb */
+  case 0x21: /* lh */
+  case 0x23: /* lw */
+  case 0x24: /* lbu */
+  case 0x25: /* lhu */ {
+    emit_addr(inst);
+    emit_mov_imm(ESI, jit_load_kind(inst));
+    emit_helper_call(k, jit_vaddr_load);
+    if (rt == 0) return;
+    break;
+  }
+  case 0x28: /* sb */
+  case 0x29: /* sh */
+  case 0x2b: /* sw */
+    emit_addr(inst);
+    emit_load_gpr(ESI, rt);
+    emit_mov_imm(EDX, inst.op == 0x28 ? 1 : inst.op == 0x29 ? 2 : 4);
+    emit_helper_call(k, jit_vaddr_store);
+    return;
+  default: panic("instruction %08x can not be compiled\n", inst.val);
+  }
+  emit_store(EAX, GPR(rt));
+}
+
+void jit_reset() { jit_ptr = jit_buf; }
+
+/* returns NULL when the code buffer is exhausted */
+jit_code_t jit_compile(const Inst *code, int n) {
+  if (!jit_buf) {
+    jit_buf = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(jit_buf != MAP_FAILED, "can not allocate jit code buffer");
+    jit_ptr = jit_buf;
+  }
+
+  if (jit_buf + JIT_CODE_SIZE - jit_ptr < (n + 1) * JIT_MAX_INSTR_SIZE)
+    return NULL;
+
+  jit_code_t entry = (jit_code_t)jit_ptr;
+  emit1(0x53); /* push rbx */
+  emit1(0x48); /* movabs rbx, &cpu */
+  emit1(0xB8 | EBX);
+  emit8((uintptr_t)&cpu);
+
+  jit_pc_index = 0;
+  for (int i = 0; i < n; i++) {
+    assert(jit_supported(code[i]));
+    emit_inst(code[i], i);
+  }
+
+  emit_epilogue(n);
+  return entry;
+}
+
+#endif
+
+#if CONFIG_JIT || CONFIG_AOT
+
+#  include "common.h"
+#  include "jit.h"
+
+/* what compiled and translated code may contain, it must
+ * accept exactly what instr.h executes without raising an
+ * exception, or what it raises through jit_vaddr_* */
+bool jit_supported(Inst inst) {
+  switch (inst.op) {
+  case 0x00:
+    switch (inst.func) {
+    case 0x00: /* sll */
+    case 0x03: /* sra */ return inst.rs == 0;
+    case 0x02: /* srl, rotr with rs 1 */
+      return inst.rs == 0 || (CONFIG_IS_ENABLED(MIPS32_R2) && inst.rs == 1);
+    case 0x06: /* srlv, rotrv with shamt 1 */
+      return inst.shamt == 0 ||
+             (CONFIG_IS_ENABLED(MIPS32_R2) && inst.shamt == 1);
+    case 0x04: /* sllv */
+    case 0x07: /* srav */
+    case 0x0a: /* movz */
+    case 0x0b: /* movn */
+    case 0x21: /* addu */
+    case 0x23: /* subu */
+    case 0x24: /* and */
+    case 0x25: /* or */
+    case 0x26: /* xor */
+    case 0x27: /* nor */
+    case 0x2a: /* slt */
+    case 0x2b: /* sltu */ return inst.shamt == 0;
+    case 0x10: /* mfhi */
+    case 0x12: /* mflo */
+      return inst.rs == 0 && inst.rt == 0 && inst.shamt == 0;
+    case 0x11: /* mthi */
+    case 0x13: /* mtlo */
+      return inst.rt == 0 && inst.rd == 0 && inst.shamt == 0;
+    case 0x18: /* mult */
+    case 0x19: /* multu */ return inst.rd == 0 && inst.shamt == 0;
+    default: return false;
+    }
+  case 0x09: /* addiu */
+  case 0x0a: /* slti */
+  case 0x0b: /* sltiu */
+  case 0x0c: /* andi */
+  case 0x0d: /* ori */
+  case 0x0e: /* xori */ return true;
+  case 0x0f: /* lui */ return inst.rs == 0;
+  case 0x1c: /* mul */ return inst.func == 0x02 && inst.shamt == 0;
+  case 0x1f: /* seb, seh, ext */
+    if (CONFIG_IS_ENABLED(MIPS32_R2) && inst.func == 0x00)
+      return inst.shamt + inst.rd < 32;
+    return inst.func == 0x20 && (inst.shamt == 0x10 || inst.shamt == 0x18);
+  case 0x20: /* lb */
+  case 0x21: /* lh */
+  case 0x23: /* lw */
+  case 0x24: /* lbu */
+  case 0x25: /* lhu */
+  case 0x28: /* sb */
+  case 0x29: /* sh */
+  case 0x2b: /* sw */ return true;
+  default: return false;
+  }
+}
+
+int jit_load_kind(Inst inst) {
+  static const int kinds[] = {
+      [0x0] = 1 | JIT_LOAD_SIGNED,
+      [0x1] = 2 | JIT_LOAD_SIGNED,
+      [0x3] = 4,
+      [0x4] = 1,
+      [0x5] = 2,
+  };
+  return kinds[inst.op & 0x7];
+}
+
+#endif
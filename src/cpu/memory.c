@@ -3,24 +3,153 @@
 
 #include <SDL/SDL.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#if CONFIG_SHARED_RAM
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <string.h>
+#  include <unistd.h>
 
-void clear_decode_cache();
+#  include "shared-ram.h"
+#endif
 
-device_t *memory_regions[1024 * 1024]; /* 8 MB */
+/* realized devices, sorted by start */
+static device_t *devices[64];
+static int nr_devices = 0;
+
+/* the largest one with host memory */
+device_t *guest_ram_device = NULL;
+__percpu device_t *last_device = NULL;
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+bool guest_ram_hugetlb = false;
+
+#if CONFIG_SHARED_RAM
+extern const char *shared_ram_name;
+static int shared_ram_fd = -1;
+static shared_ram_header_t *shared_ram_header;
+static uint64_t shared_ram_end = HUGE_PAGE_SIZE;
+
+/* observers that mapped it keep it, it is gone for new ones */
+static void shared_ram_unlink() { shm_unlink(shared_ram_name); }
+
+/* place the ram of dev after the regions before it in the
+ * shm object, growing it leaves the new pages unallocated */
+static void *shared_ram_alloc(device_t *dev) {
+  if (shared_ram_fd < 0) {
+    /* never taken over from a running nemu, one left by a
+     * crash has to be removed by hand */
+    shared_ram_fd =
+        shm_open(shared_ram_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (shared_ram_fd < 0 && errno == EEXIST)
+      panic("shm object %s exists, remove /dev/shm/%s if no nemu uses it\n",
+          shared_ram_name, shared_ram_name);
+    Assert(shared_ram_fd >= 0, "cannot create shm object %s: %s",
+        shared_ram_name, strerror(errno));
+    atexit(shared_ram_unlink);
+    Assert(ftruncate(shared_ram_fd, shared_ram_end) == 0,
+        "cannot grow shm object %s", shared_ram_name);
+    shared_ram_header = mmap(NULL, sizeof(shared_ram_header_t),
+        PROT_READ | PROT_WRITE, MAP_SHARED, shared_ram_fd, 0);
+    Assert(shared_ram_header != MAP_FAILED, "cannot map shm object");
+    shared_ram_header->magic = SHARED_RAM_MAGIC;
+    shared_ram_header->version = SHARED_RAM_VERSION;
+  }
+
+  uint32_t n = shared_ram_header->nr_regions;
+  Assert(n < SHARED_RAM_MAX_REGIONS, "too many shared ram regions");
+  uint64_t offset = shared_ram_end;
+  shared_ram_end += (dev->size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  Assert(ftruncate(shared_ram_fd, shared_ram_end) == 0,
+      "cannot grow shm object %s", shared_ram_name);
+  void *ram = mmap(NULL, dev->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      shared_ram_fd, offset);
+  Assert(ram != MAP_FAILED, "cannot map %s of shm object", dev->name);
+
+  shared_ram_region_t *region = &shared_ram_header->regions[n];
+  strncpy(region->name, dev->name, sizeof(region->name) - 1);
+  region->paddr = dev->start;
+  region->size = dev->size;
+  region->offset = offset;
+  __atomic_store_n(&shared_ram_header->nr_regions, n + 1, __ATOMIC_RELEASE);
+  return ram;
+}
+#endif
+
+/* zero filled on first touch, only touched pages take host
+ * memory, huge pages cut host tlb misses on large guests */
+void *guest_ram_alloc(device_t *dev) {
+  uint32_t size = dev->size;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#if CONFIG_SHARED_RAM
+  if (shared_ram_name) return shared_ram_alloc(dev);
+#endif
+#if CONFIG_HUGETLB
+  size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  /* reserved up front, a short pool fails here and not
+   * with SIGBUS on first touch */
+  void *huge = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (huge != MAP_FAILED) {
+    guest_ram_hugetlb = true;
+    return huge;
+  }
+  Log("no huge pages for %u bytes of guest ram, see "
+      "/proc/sys/vm/nr_hugepages\n", size);
+#endif
+
+  /* align to a huge page so that all of it can be one */
+  size_t len = (size_t)size + HUGE_PAGE_SIZE;
+  uint8_t *p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+  Assert(p != MAP_FAILED, "cannot map %u bytes of guest ram", size);
+  uint8_t *ram = (uint8_t *)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) &
+                             ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+  if (ram > p) munmap(p, ram - p);
+  munmap(ram + size, p + len - (ram + size));
+#ifdef MADV_HUGEPAGE
+  madvise(ram, size, MADV_HUGEPAGE);
+#endif
+  return ram;
+}
 
 void realize_device(device_t *dev) {
   assert(dev && (dev->start & 0xFFF) == 0);
   // assert((dev->end & 0xFFF) == 0);
 
-  uint32_t _4KB = 4 * 1024;
-  for (uint32_t i = dev->start; i < dev->start + dev->size; i += _4KB) {
-    assert(memory_regions[mr_index(i)] == NULL);
-    memory_regions[mr_index(i)] = dev;
-  }
+  Assert(nr_devices < sizeof(devices) / sizeof(*devices), "too many devices");
+  int i = nr_devices++;
+  for (; i > 0 && devices[i - 1]->start > dev->start; i--)
+    devices[i] = devices[i - 1];
+  devices[i] = dev;
+
+  device_t *prev = i > 0 ? devices[i - 1] : NULL;
+  device_t *next = i + 1 < nr_devices ? devices[i + 1] : NULL;
+  Assert(!prev || (uint64_t)prev->start + prev->size <= dev->start,
+      "%s overlaps %s at 0x%08x", dev->name, prev->name, dev->start);
+  Assert(!next || (uint64_t)dev->start + dev->size <= next->start,
+      "%s overlaps %s at 0x%08x", dev->name, next->name, next->start);
+
+  if (dev->map && (!guest_ram_device || dev->size > guest_ram_device->size))
+    guest_ram_device = dev;
 
   if (dev->init) dev->init();
 }
 
+device_t *find_device_slow(paddr_t addr) {
+  /* the last device starting at or below addr */
+  int lo = 0, hi = nr_devices;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (devices[mid]->start <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0 || !device_contains(devices[lo - 1], addr)) return NULL;
+  return last_device = devices[lo - 1];
+}
+
 void *vaddr_map(paddr_t addr, uint32_t len) {
   // only unmapped address can be map
   Assert(is_unmapped(addr), "addr %08x should be unmapped\n", addr);
@@ -29,6 +158,7 @@ void *vaddr_map(paddr_t addr, uint32_t len) {
   device_t *dev = find_device(addr);
   Assert(
       dev && dev->map, "invalid address(0x%08x), pc(0x%08x)\n", addr, cpu.pc);
+  invalidate_decode_range(addr, len);
   return dev->map(addr - dev->start, len);
 }
 
@@ -46,7 +176,7 @@ void dbg_vaddr_write(vaddr_t addr, int len, uint32_t data) {
   device_t *dev = find_device(addr);
   if (!dev || !dev->write) return;
   dev->write(addr - dev->start, len, data);
-  clear_decode_cache();
+  invalidate_decode_range(addr, len);
 }
 
 uint32_t paddr_peek(paddr_t addr, int len) {
@@ -6,19 +6,83 @@
 
 extern device_t blackhole_dev;
 
-tlb_entry_t tlb[NR_TLB_ENTRY];
+__percpu tlb_entry_t tlb[NR_TLB_ENTRY];
 
 extern void signal_exception(unsigned);
 
-void tlb_present() {
-  for (int i = 0; i < NR_TLB_ENTRY; i++) {
-    uint32_t mask = tlb[i].pagemask;
-    assert(mask == 0 || (mask | (mask + 1)) == 0);
-    bool match = (tlb[i].vpn & ~mask) == (cpu.cp0.entry_hi.vpn & ~mask) &&
-                 (tlb[i].g || tlb[i].asid == cpu.cp0.entry_hi.asid);
+/* every entry is kept in a hash table keyed by its masked
+ * VPN2, its pagemask and its asid (or TLB_ANY_ASID when it
+ * is global), a lookup probes two buckets per pagemask in
+ * use instead of scanning the whole tlb */
+#define TLB_HASH_BITS 8
+#define TLB_NONE 0xFF
+#define TLB_ANY_ASID 0x100
+
+static __percpu uint8_t tlb_hash[1 << TLB_HASH_BITS];
+static __percpu uint8_t tlb_next[NR_TLB_ENTRY];
+static __percpu uint8_t tlb_mask_refs[17]; /* entries per pagemask width */
+static __percpu uint32_t tlb_masks;        /* widths with tlb_mask_refs > 0 */
 
-    if (!match) continue;
+static inline uint32_t tlb_hash_index(uint32_t vpn, int k, uint32_t asid) {
+  uint32_t h = (((vpn >> k) * 31 + asid) * 31 + k) * 0x9E3779B1u;
+  return h >> (32 - TLB_HASH_BITS);
+}
+
+static inline uint32_t tlb_entry_asid(uint32_t i) {
+  return tlb[i].g ? TLB_ANY_ASID : tlb[i].asid;
+}
 
+static uint8_t *tlb_bucket(uint32_t i) {
+  int k = __builtin_popcount(tlb[i].pagemask);
+  return &tlb_hash[tlb_hash_index(tlb[i].vpn, k, tlb_entry_asid(i))];
+}
+
+static void tlb_index_insert(uint32_t i) {
+  int k = __builtin_popcount(tlb[i].pagemask);
+  uint8_t *head = tlb_bucket(i);
+  tlb_next[i] = *head;
+  *head = i;
+  if (tlb_mask_refs[k]++ == 0) tlb_masks |= 1u << k;
+}
+
+static void tlb_index_remove(uint32_t i) {
+  int k = __builtin_popcount(tlb[i].pagemask);
+  uint8_t *p = tlb_bucket(i);
+  while (*p != i) p = &tlb_next[*p];
+  *p = tlb_next[i];
+  if (--tlb_mask_refs[k] == 0) tlb_masks &= ~(1u << k);
+}
+
+/* the lowest index matching vpn (a VPN2) and asid, or -1,
+ * same as a linear scan would find */
+static int tlb_lookup(uint32_t vpn, uint32_t asid) {
+  int found = NR_TLB_ENTRY;
+  for (uint32_t masks = tlb_masks; masks; masks &= masks - 1) {
+    int k = __builtin_ctz(masks);
+    uint32_t mask = (1u << k) - 1;
+    uint32_t asids[2] = {asid, TLB_ANY_ASID};
+    for (int j = 0; j < 2; j++) {
+      uint32_t h = tlb_hash_index(vpn & ~mask, k, asids[j]);
+      for (int i = tlb_hash[h]; i != TLB_NONE; i = tlb_next[i]) {
+        if (i < found && tlb[i].pagemask == mask &&
+            tlb[i].vpn == (vpn & ~mask) && tlb_entry_asid(i) == asids[j])
+          found = i;
+      }
+    }
+  }
+  return found < NR_TLB_ENTRY ? found : -1;
+}
+
+void tlb_init() {
+  memset(tlb_hash, TLB_NONE, sizeof(tlb_hash));
+  memset(tlb_mask_refs, 0, sizeof(tlb_mask_refs));
+  tlb_masks = 0;
+  for (int i = 0; i < NR_TLB_ENTRY; i++) tlb_index_insert(i);
+}
+
+void tlb_present() {
+  int i = tlb_lookup(cpu.cp0.entry_hi.vpn, cpu.cp0.entry_hi.asid);
+  if (i >= 0) {
     /* match this tlb entry */
     cpu.cp0.index.p = 0;
     cpu.cp0.index.idx = i;
@@ -45,6 +109,27 @@ void tlb_read(uint32_t i) {
   cpu.cp0.entry_lo1.g = tlb[i].g;
 }
 
+static void tlb_fill(uint32_t i, uint32_t mask, uint32_t vpn, uint32_t asid,
+    cp0_entry_lo_t lo0, cp0_entry_lo_t lo1) {
+  tlb_index_remove(i);
+  tlb[i].pagemask = mask;
+  tlb[i].vpn = vpn & ~mask;
+  tlb[i].asid = asid;
+
+  tlb[i].g = lo0.g & lo1.g;
+
+  tlb[i].p0.pfn = lo0.pfn & ~mask;
+  tlb[i].p0.c = lo0.c;
+  tlb[i].p0.d = lo0.d;
+  tlb[i].p0.v = lo0.v;
+
+  tlb[i].p1.pfn = lo1.pfn & ~mask;
+  tlb[i].p1.c = lo1.c;
+  tlb[i].p1.d = lo1.d;
+  tlb[i].p1.v = lo1.v;
+  tlb_index_insert(i);
+}
+
 void tlb_write(uint32_t i) {
 #if 0
   uint32_t mask = cpu.cp0.pagemask.mask;
@@ -54,21 +139,10 @@ void tlb_write(uint32_t i) {
   eprintf("%08x: TLB[%d]: MAP %08x -> %08x, %08x -> %08x\n", cpu.pc, i, vpn,
       pfn0, vpn | 0x1000, pfn1);
 #endif
-  tlb[i].pagemask = cpu.cp0.pagemask.mask;
-  tlb[i].vpn = cpu.cp0.entry_hi.vpn & ~cpu.cp0.pagemask.mask;
-  tlb[i].asid = cpu.cp0.entry_hi.asid;
-
-  tlb[i].g = cpu.cp0.entry_lo0.g & cpu.cp0.entry_lo1.g;
-
-  tlb[i].p0.pfn = cpu.cp0.entry_lo0.pfn & ~cpu.cp0.pagemask.mask;
-  tlb[i].p0.c = cpu.cp0.entry_lo0.c;
-  tlb[i].p0.d = cpu.cp0.entry_lo0.d;
-  tlb[i].p0.v = cpu.cp0.entry_lo0.v;
-
-  tlb[i].p1.pfn = cpu.cp0.entry_lo1.pfn & ~cpu.cp0.pagemask.mask;
-  tlb[i].p1.c = cpu.cp0.entry_lo1.c;
-  tlb[i].p1.d = cpu.cp0.entry_lo1.d;
-  tlb[i].p1.v = cpu.cp0.entry_lo1.v;
+  uint32_t mask = cpu.cp0.pagemask.mask;
+  CPUAssert((mask & (mask + 1)) == 0, "unsupported pagemask %08x\n", mask);
+  tlb_fill(i, mask, cpu.cp0.entry_hi.vpn, cpu.cp0.entry_hi.asid,
+      cpu.cp0.entry_lo0, cpu.cp0.entry_lo1);
 }
 
 static void tlb_exception(int ex, int code, vaddr_t vaddr, unsigned asid) {
@@ -83,16 +157,64 @@ static void tlb_exception(int ex, int code, vaddr_t vaddr, unsigned asid) {
 #endif
 }
 
+#if CONFIG_PAGE_WALKER
+/* a word of the page table, which must sit in unmapped memory */
+static bool tlb_walk_read(vaddr_t vaddr, uint32_t *data) {
+  if (!is_unmapped(vaddr)) return false;
+  paddr_t paddr = ioremap(vaddr);
+  device_t *dev = find_device(paddr);
+  if (!dev || !dev->map) return false;
+  *data = dev->peek(paddr - dev->start, 4);
+  return true;
+}
+
+/* walk the page table at PWBase as laid out by PWField and
+ * PWSize and install the pair mapping vaddr into a random
+ * unwired entry, -1 sends the miss to the refill handler */
+static int tlb_walk(vaddr_t vaddr) {
+  cp0_pwfield_t field = cpu.cp0.pwfield;
+  cp0_pwsize_t size = cpu.cp0.pwsize;
+  if (!cpu.cp0.pwctl.PWEn || size.PS || field.PTI < 12) return -1;
+
+  uint32_t dirs[3][2] = {
+      {field.GDI, size.GDW}, {field.UDI, size.UDW}, {field.MDI, size.MDW}};
+  vaddr_t base = cpu.cp0.pwbase;
+  for (int l = 0; l < 3; l++) {
+    if (dirs[l][1] == 0) continue;
+    uint32_t idx = (vaddr >> dirs[l][0]) & ((1u << dirs[l][1]) - 1);
+    if (!tlb_walk_read(base + idx * 4, &base)) return -1;
+  }
+
+  uint32_t idx = (vaddr >> field.PTI) & ((1u << size.PTW) - 1) & ~1;
+  uint32_t pte[2];
+  for (int j = 0; j < 2; j++) {
+    vaddr_t addr = base + ((idx + j) << (2 + size.PTEW));
+    if (!tlb_walk_read(addr, &pte[j])) return -1;
+    pte[j] >>= field.PTEI;
+  }
+
+  uint32_t mask = (1u << (field.PTI - 12)) - 1;
+  cp0_entry_lo_t *lo = (void *)pte;
+  if (!lo[(vaddr >> field.PTI) & 1].v) return -1;
+
+  uint32_t wired = cpu.cp0.wired;
+  if (wired >= NR_TLB_ENTRY) return -1;
+  uint32_t i = wired + rand() % (NR_TLB_ENTRY - wired);
+  invalidate_tlb_entry(i);
+  tlb_fill(i, mask, vaddr >> 13, cpu.cp0.entry_hi.asid, lo[0], lo[1]);
+  return i;
+}
+#endif
+
 vaddr_t page_translate(vaddr_t vaddr, mmu_attr_t *attr) {
   uint32_t exccode = attr->rwbit == MMU_LOAD ? EXC_TLBL : EXC_TLBS;
   uint32_t va_31_13 = (vaddr & ~0x1FFF) >> 13;
-  for (int i = 0; i < NR_TLB_ENTRY; i++) {
+  int i = tlb_lookup(va_31_13, cpu.cp0.entry_hi.asid);
+#if CONFIG_PAGE_WALKER
+  if (i < 0 && attr->exbit) i = tlb_walk(vaddr);
+#endif
+  if (i >= 0) {
     uint32_t mask = tlb[i].pagemask;
-    assert(mask == 0 || (mask | (mask + 1)) == 0);
-    bool match = (tlb[i].vpn & ~mask) == (va_31_13 & ~mask) &&
-                 (tlb[i].g || tlb[i].asid == cpu.cp0.entry_hi.asid);
-    if (!match) continue;
-
     bool EvenOddBit = vaddr & ((mask + 1) << 12);
     /* match the vpn and asid */
     tlb_phyn_t *phyn = EvenOddBit ? &(tlb[i].p1) : &(tlb[i].p0);
@@ -126,6 +248,7 @@ vaddr_t page_translate(vaddr_t vaddr, mmu_attr_t *attr) {
           cpu.pc, i, vpn, pfn0, vpn | 0x1000, pfn1, vaddr, highbits | lowbits);
 #endif
       attr->dirty = phyn->d;
+      attr->pgshift = 12 + __builtin_popcount(mask);
       return highbits | lowbits;
     }
   }
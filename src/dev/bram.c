@@ -3,7 +3,11 @@
 // block ram
 #define BRAM_SIZE (1024 * 1024)
 
-static uint8_t bram[BRAM_SIZE];
+static uint8_t *bram;
+
+extern device_t bram_dev;
+
+static void bram_init() { bram = guest_ram_alloc(&bram_dev); }
 
 static void *bram_map(uint32_t addr, uint32_t len) {
   check_ioaddr(addr, len, BRAM_SIZE, "bram.map");
@@ -12,7 +16,9 @@ static void *bram_map(uint32_t addr, uint32_t len) {
 
 static uint32_t bram_read(paddr_t addr, int len) {
   check_ioaddr(addr, len, BRAM_SIZE, "bram.read");
-  return *((uint32_t *)((void *)bram + addr)) & (~0u >> ((4 - len) << 3));
+  uint32_t data = 0;
+  memcpy(&data, (void *)bram + addr, len);
+  return data;
 }
 
 static void bram_write(paddr_t addr, int len, uint32_t data) {
@@ -29,6 +35,7 @@ DEF_DEV(bram_dev) = {
     .name = "block-ram",
     .start = CONFIG_BRAM_BASE,
     .size = BRAM_SIZE,
+    .init = bram_init,
     .read = bram_read,
     .write = bram_write,
     .map = bram_map,
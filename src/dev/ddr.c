@@ -1,35 +1,50 @@
 #include "device.h"
 
-#define DDR_SIZE (128 * 1024 * 1024) // 0x08000000
+static uint8_t *ddr;
+static uint32_t ddr_size = CONFIG_DDR_SIZE;
+
+extern device_t ddr_dev;
+
+/* called before the device is realized, by --ddr-size,
+ * physical addresses are 29 bits wide */
+void ddr_set_size(uint32_t size) {
+  if ((uint64_t)CONFIG_DDR_BASE + size > 0x20000000)
+    panic("DDR of %u bytes at %08x ends above 512 MB\n", size,
+        CONFIG_DDR_BASE);
+  ddr_size = ddr_dev.size = size;
+}
 
-static uint8_t ddr[DDR_SIZE];
+static void ddr_init() { ddr = guest_ram_alloc(&ddr_dev); }
 
 /* Memory accessing interfaces */
 
 static void *ddr_map(uint32_t addr, uint32_t len) {
-  check_ioaddr(addr, len, DDR_SIZE, "ddr.map");
+  check_ioaddr(addr, len, ddr_size, "ddr.map");
   return &ddr[addr];
 }
 
 static uint32_t ddr_read(paddr_t addr, int len) {
-  check_ioaddr(addr, len, DDR_SIZE, "ddr.read");
-  return *((uint32_t *)((void *)ddr + addr)) & (~0u >> ((4 - len) << 3));
+  check_ioaddr(addr, len, ddr_size, "ddr.read");
+  uint32_t data = 0;
+  memcpy(&data, (void *)ddr + addr, len);
+  return data;
 }
 
 static void ddr_write(paddr_t addr, int len, uint32_t data) {
-  check_ioaddr(addr, len, DDR_SIZE, "ddr.write");
+  check_ioaddr(addr, len, ddr_size, "ddr.write");
   memcpy((uint8_t *)ddr + addr, &data, len);
 }
 
 static void ddr_set_block_data(paddr_t addr, const void *data, int len) {
-  check_ioaddr(addr, len, DDR_SIZE, "ddr.write");
+  check_ioaddr(addr, len, ddr_size, "ddr.write");
   memcpy((void *)ddr + addr, data, len);
 }
 
 DEF_DEV(ddr_dev) = {
     .name = "ddr",
     .start = CONFIG_DDR_BASE,
-    .size = DDR_SIZE,
+    .size = CONFIG_DDR_SIZE,
+    .init = ddr_init,
     .read = ddr_read,
     .write = ddr_write,
     .map = ddr_map,
@@ -4,14 +4,13 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "device.h"
 #include "events.h"
 #include "utils.h"
 
-void check_cp0_timer();
-
 SDL_Surface *screen;
 static struct itimerval it;
 
@@ -30,7 +29,123 @@ int notify_event(int event_type, void *data, int len) {
   assert(0 <= event_type && event_type < NR_EVENTS);
 
   event_t *evt = &events[event_type];
-  return evt->handler(data, len);
+  int ret = evt->handler(data, len);
+  cpu_kick(); /* a device may have changed under a polling cpu */
+  return ret;
+}
+
+#define NR_TIMERS 32
+
+static nemu_timer_t *timer_heap[NR_TIMERS];
+static int nr_timers = 0;
+
+/* read by the event thread to wake the cpu in real time */
+static volatile uint64_t timer_deadline = -1ull;
+static pthread_mutex_t timer_mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond = PTHREAD_COND_INITIALIZER;
+
+#if CONFIG_SMP
+/* every vcpu arms and runs timers from its own thread */
+static pthread_mutex_t heap_mut = PTHREAD_MUTEX_INITIALIZER;
+#  define heap_lock() pthread_mutex_lock(&heap_mut)
+#  define heap_unlock() pthread_mutex_unlock(&heap_mut)
+#else
+#  define heap_lock()
+#  define heap_unlock()
+#endif
+
+static void timer_heap_set(int i, nemu_timer_t *timer) {
+  timer_heap[i] = timer;
+  timer->slot = i;
+}
+
+static void timer_heap_up(int i) {
+  nemu_timer_t *timer = timer_heap[i];
+  while (i > 0 && timer_heap[(i - 1) / 2]->deadline > timer->deadline) {
+    timer_heap_set(i, timer_heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  timer_heap_set(i, timer);
+}
+
+static void timer_heap_down(int i) {
+  nemu_timer_t *timer = timer_heap[i];
+  while (2 * i + 1 < nr_timers) {
+    int c = 2 * i + 1;
+    if (c + 1 < nr_timers && timer_heap[c + 1]->deadline < timer_heap[c]->deadline)
+      c++;
+    if (timer->deadline <= timer_heap[c]->deadline) break;
+    timer_heap_set(i, timer_heap[c]);
+    i = c;
+  }
+  timer_heap_set(i, timer);
+}
+
+/* the cpu only looks at the earliest deadline again when
+ * kicked */
+static void timer_heap_changed() {
+  uint64_t deadline = nr_timers ? timer_heap[0]->deadline : -1ull;
+  if (deadline != timer_deadline) {
+    pthread_mutex_lock(&timer_mut);
+    timer_deadline = deadline;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mut);
+    cpu_kick();
+  }
+}
+
+void nemu_timer_init(nemu_timer_t *timer, nemu_timer_cb_t cb, void *opaque) {
+  timer->deadline = -1ull;
+  timer->cb = cb;
+  timer->opaque = opaque;
+  timer->slot = -1;
+}
+
+static void timer_heap_remove(nemu_timer_t *timer) {
+  int i = timer->slot;
+  if (i < 0) return;
+
+  timer->slot = -1;
+  if (i != --nr_timers) {
+    nemu_timer_t *last = timer_heap[nr_timers];
+    timer_heap_set(i, last);
+    timer_heap_up(i);
+    timer_heap_down(last->slot);
+  }
+  timer_heap_changed();
+}
+
+void nemu_timer_del(nemu_timer_t *timer) {
+  heap_lock();
+  timer_heap_remove(timer);
+  heap_unlock();
+}
+
+void nemu_timer_mod(nemu_timer_t *timer, uint64_t deadline) {
+  heap_lock();
+  if (timer->slot < 0) {
+    assert(nr_timers < NR_TIMERS);
+    timer_heap_set(nr_timers++, timer);
+  }
+  timer->deadline = deadline;
+  timer_heap_up(timer->slot);
+  timer_heap_down(timer->slot);
+  timer_heap_changed();
+  heap_unlock();
+}
+
+uint64_t nemu_timer_deadline() { return timer_deadline; }
+
+void nemu_timer_run(uint64_t now) {
+  heap_lock();
+  while (nr_timers > 0 && timer_heap[0]->deadline <= now) {
+    nemu_timer_t *timer = timer_heap[0];
+    timer_heap_remove(timer);
+    heap_unlock(); /* the callback may arm it again */
+    timer->cb(timer->opaque);
+    heap_lock();
+  }
+  heap_unlock();
 }
 
 void detect_sdl_event() {
@@ -91,9 +206,6 @@ void device_update(int signum) {
 #if CONFIG_NETWORK
   net_poll_packet();
 #endif
-#if CONFIG_INTR
-  check_cp0_timer();
-#endif
 }
 
 #if CONFIG_ENABLE_CTRL_C_Z
@@ -135,8 +247,33 @@ void init_sdl() {
   SDL_EnableKeyRepeat(SDL_DEFAULT_REPEAT_DELAY, SDL_DEFAULT_REPEAT_INTERVAL);
 }
 
+#define EVENT_POLL_HZ 1000
+
+/* input is polled, timers are run by the cpu itself, in
+ * real time it has to be woken once one is due */
 void *event_loop(void *args) {
-  while (1) { device_update(0); }
+  while (1) {
+    device_update(0);
+
+    uint64_t wait = 1000000 / EVENT_POLL_HZ; // us
+    pthread_mutex_lock(&timer_mut);
+#if !CONFIG_VIRTUAL_TIME
+    uint64_t now = mips_get_count();
+    if (now >= timer_deadline) {
+      cpu_kick();
+    } else if ((timer_deadline - now) / 50 < wait) {
+      wait = (timer_deadline - now) / 50;
+    }
+#endif
+    /* an earlier deadline wakes us up */
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += wait * 1000;
+    ts.tv_sec += ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+    pthread_cond_timedwait(&timer_cond, &timer_mut, &ts);
+    pthread_mutex_unlock(&timer_mut);
+  }
   return NULL;
 }
 
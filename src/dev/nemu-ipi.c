@@ -0,0 +1,64 @@
+#include "device.h"
+
+/* inter-processor interrupts and vcpu start, every vcpu
+ * sees its own IPI and ACK registers */
+#define NEMU_IPI_CPUID 0x0  /* r: id of the accessing vcpu */
+#define NEMU_IPI_NCPUS 0x4  /* r: number of vcpus */
+#define NEMU_IPI_SEND 0x8   /* w: raise the ipi of vcpus in the mask */
+#define NEMU_IPI_STAT 0xC   /* r: ipi pending on the accessing vcpu */
+#define NEMU_IPI_ACK 0x10   /* w: drop the ipi of the accessing vcpu */
+#define NEMU_IPI_ENTRY 0x14 /* rw: pc of the next started vcpu */
+#define NEMU_IPI_ARG 0x18   /* rw: its $a0 */
+#define NEMU_IPI_START 0x1C /* w: start the vcpu of this id */
+#define NEMU_IPI_SIZE 0x20
+
+#define NEMU_IPI_IRQ_NO 6
+
+/* vcpus take turns at devices, no lock needed here */
+static uint32_t nemu_ipi_pending = 0;
+static uint32_t nemu_ipi_entry = 0;
+static uint32_t nemu_ipi_arg = 0;
+
+static uint32_t nemu_ipi_read(paddr_t addr, int len) {
+  check_aligned_ioaddr(addr, len, NEMU_IPI_SIZE, "ipi.read");
+  switch (addr) {
+  case NEMU_IPI_CPUID: return cpu_current_id();
+  case NEMU_IPI_NCPUS: return CONFIG_NR_CPUS;
+  case NEMU_IPI_STAT: return (nemu_ipi_pending >> cpu_current_id()) & 1;
+  case NEMU_IPI_ENTRY: return nemu_ipi_entry;
+  case NEMU_IPI_ARG: return nemu_ipi_arg;
+  }
+  return 0;
+}
+
+static void nemu_ipi_write(paddr_t addr, int len, uint32_t data) {
+  check_aligned_ioaddr(addr, len, NEMU_IPI_SIZE, "ipi.write");
+  switch (addr) {
+  case NEMU_IPI_SEND:
+    for (int i = 0; i < CONFIG_NR_CPUS; i++) {
+      if (!((data >> i) & 1)) continue;
+      nemu_ipi_pending |= 1 << i;
+      nemu_set_cpu_irq(i, NEMU_IPI_IRQ_NO, 1);
+    }
+    break;
+  case NEMU_IPI_ACK:
+    nemu_ipi_pending &= ~(1 << cpu_current_id());
+    nemu_set_cpu_irq(cpu_current_id(), NEMU_IPI_IRQ_NO, 0);
+    break;
+  case NEMU_IPI_ENTRY: nemu_ipi_entry = data; break;
+  case NEMU_IPI_ARG: nemu_ipi_arg = data; break;
+  case NEMU_IPI_START:
+    CPUAssert(0 < data && data < CONFIG_NR_CPUS, "ipi: no vcpu %d", data);
+    cpu_start(data, nemu_ipi_entry, nemu_ipi_arg);
+    break;
+  }
+}
+
+DEF_DEV(nemu_ipi_dev) = {
+    .name = "nemu-ipi",
+    .start = CONFIG_NEMU_IPI_BASE,
+    .size = NEMU_IPI_SIZE,
+    .read = nemu_ipi_read,
+    .peek = nemu_ipi_read,
+    .write = nemu_ipi_write,
+};
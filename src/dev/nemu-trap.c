@@ -15,6 +15,7 @@ static void nemu_trap_write(paddr_t addr, int len, uint32_t data) {
   }
 
   nemu_state = NEMU_END;
+  cpu_kick();
   // directly exit, so that we will not print one more
   // commit log which makes it easier for crosschecking.
   if (work_mode & MODE_BATCH) nemu_exit();
@@ -60,6 +60,7 @@ static void stop_cpu_check(char ch) {
       print_frames();
       print_backtrace();
       nemu_state = NEMU_STOP;
+      cpu_kick();
     }
   } else {
     xlnx_ulite_stop_string_ptr = xlnx_ulite_stop_string;
@@ -14,85 +14,51 @@ typedef struct {
   int elf_strtab_size;
 } elf_desc_t;
 
-static char *elf_strtab = NULL;      /* needs free */
-static Elf32_Sym *elf_symtab = NULL; /* needs free */
+/* both point into the mapped elf */
+static const char *elf_strtab = NULL;
+static const Elf32_Sym *elf_symtab = NULL;
 static int nr_symtab_entry = 0;
 static int elf_strtab_size = 0;
 
 void elf_symbols_release_memory() {
-  if (elf_strtab) {
-    free(elf_strtab);
-    elf_strtab = NULL;
-  }
-  if (elf_symtab) {
-    free(elf_symtab);
-    elf_symtab = NULL;
-  }
-
+  elf_strtab = NULL;
+  elf_symtab = NULL;
   nr_symtab_entry = 0;
   elf_strtab_size = 0;
 }
 
 void load_elf_symtab(const char *elf_file) {
-  int ret = 0;
   elf_symbols_release_memory();
 
-  FILE *fp = fopen(elf_file, "rb");
-  Assert(fp, "Can not open '%s'", elf_file);
-
-  uint8_t buf[sizeof(Elf32_Ehdr)];
-  ret = fread(buf, sizeof(Elf32_Ehdr), 1, fp);
-  assert(ret == 1);
+  const mapped_file_t *file = map_file(elf_file);
+  Assert(file, "Can not open '%s'", elf_file);
+  const void *buf = file->p;
 
   /* The first several bytes contain the ELF header. */
-  Elf32_Ehdr *elf = (void *)buf;
+  const Elf32_Ehdr *elf = buf;
   char magic[] = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3};
 
   /* Check ELF header */
   assert(memcmp(elf->e_ident, magic, 4) == 0);
 
-  /* Load symbol table and string table for future use */
-
-  /* Load section header table */
-  uint32_t sh_size = elf->e_shentsize * elf->e_shnum;
-  Elf32_Shdr *sh = malloc(sh_size);
-  fseek(fp, elf->e_shoff, SEEK_SET);
-  ret = fread(sh, sh_size, 1, fp);
-  assert(ret == 1);
-
-  /* Load section header string table */
-  char *shstrtab = malloc(sh[elf->e_shstrndx].sh_size);
-  fseek(fp, sh[elf->e_shstrndx].sh_offset, SEEK_SET);
-  ret = fread(shstrtab, sh[elf->e_shstrndx].sh_size, 1, fp);
-  assert(ret == 1);
+  /* Find symbol table and string table for future use */
+  const Elf32_Shdr *sh = buf + elf->e_shoff;
+  const char *shstrtab = buf + sh[elf->e_shstrndx].sh_offset;
 
   int i;
   for (i = 0; i < elf->e_shnum; i++) {
     if (sh[i].sh_type == SHT_SYMTAB &&
         strcmp(shstrtab + sh[i].sh_name, ".symtab") == 0) {
-      /* Load symbol table from elf_file */
-      elf_symtab = malloc(sh[i].sh_size);
-      fseek(fp, sh[i].sh_offset, SEEK_SET);
-      ret = fread(elf_symtab, sh[i].sh_size, 1, fp);
-      assert(ret == 1);
+      elf_symtab = buf + sh[i].sh_offset;
       nr_symtab_entry = sh[i].sh_size / sizeof(elf_symtab[0]);
     } else if (sh[i].sh_type == SHT_STRTAB &&
                strcmp(shstrtab + sh[i].sh_name, ".strtab") == 0) {
-      /* Load string table from exec_file */
       elf_strtab_size = sh[i].sh_size;
-      elf_strtab = malloc(sh[i].sh_size);
-      fseek(fp, sh[i].sh_offset, SEEK_SET);
-      ret = fread(elf_strtab, sh[i].sh_size, 1, fp);
-      assert(ret == 1);
+      elf_strtab = buf + sh[i].sh_offset;
     }
   }
 
-  free(sh);
-  free(shstrtab);
-
   assert(elf_strtab != NULL && elf_symtab != NULL);
-
-  fclose(fp);
 }
 
 uint32_t find_addr_of_symbol(const char *symbol) {
@@ -0,0 +1,286 @@
+#if CONFIG_LINUX_BOOT
+
+#  include <arpa/inet.h>
+#  include <elf.h>
+#  include <stdio.h>
+#  include <stdlib.h>
+#  include <string.h>
+
+#  include "device.h"
+#  include "memory.h"
+#  include "utils.h"
+
+/* Boot a vmlinux without u-boot. The kernel is loaded as an
+ * elf, the initrd and the device tree go to the top of DDR,
+ * where the kernel reserves them before it allocates, and
+ * the reset vector sets a0-a3 and jumps to the entry.
+ *
+ * With a device tree the UHI convention is used, a0 is -2
+ * and a1 the blob, whose /chosen gets the command line and
+ * the initrd. Without one, a0-a3 are argc, argv, envp and
+ * the memory size, as from YAMON, and the initrd is handed
+ * over by rd_start and rd_size on the command line. */
+
+extern const char *kernel_file;
+extern const char *initrd_file;
+extern const char *dtb_file;
+extern const char *kernel_cmdline;
+extern const char *elf_file;
+extern vaddr_t elf_entry;
+
+void load_elf();
+void load_file_data(
+    void *host, const mapped_file_t *file, size_t off, size_t len);
+
+#  define KSEG0(paddr) (0x80000000 | (paddr))
+
+#  define FDT_MAGIC 0xd00dfeed
+#  define FDT_BEGIN_NODE 1
+#  define FDT_END_NODE 2
+#  define FDT_PROP 3
+#  define FDT_NOP 4
+#  define FDT_END 9
+
+/* all fields are big endian */
+typedef struct {
+  uint32_t magic;
+  uint32_t totalsize;
+  uint32_t off_dt_struct;
+  uint32_t off_dt_strings;
+  uint32_t off_mem_rsvmap;
+  uint32_t version;
+  uint32_t last_comp_version;
+  uint32_t boot_cpuid_phys;
+  uint32_t size_dt_strings;
+  uint32_t size_dt_struct;
+} fdt_header_t;
+
+typedef struct {
+  uint8_t *p;
+  uint32_t len, cap;
+} blob_t;
+
+static void blob_put(blob_t *b, const void *data, uint32_t len) {
+  if (b->len + len > b->cap) {
+    b->cap = (b->len + len) * 2;
+    b->p = realloc(b->p, b->cap);
+    assert(b->p);
+  }
+  memcpy(b->p + b->len, data, len);
+  b->len += len;
+}
+
+static void blob_put32(blob_t *b, uint32_t v) {
+  v = htonl(v);
+  blob_put(b, &v, 4);
+}
+
+static void blob_align(blob_t *b) {
+  static const uint8_t zero[4];
+  blob_put(b, zero, -b->len & 3);
+}
+
+/* offset of name in the strings block, appended if missing */
+static uint32_t fdt_string(blob_t *strings, const char *name) {
+  for (uint32_t off = 0; off < strings->len;
+       off += strlen((char *)strings->p + off) + 1) {
+    if (strcmp((char *)strings->p + off, name) == 0) return off;
+  }
+  uint32_t off = strings->len;
+  blob_put(strings, name, strlen(name) + 1);
+  return off;
+}
+
+static void fdt_put_prop(blob_t *dt, blob_t *strings, const char *name,
+    const void *value, uint32_t len) {
+  blob_put32(dt, FDT_PROP);
+  blob_put32(dt, len);
+  blob_put32(dt, fdt_string(strings, name));
+  blob_put(dt, value, len);
+  blob_align(dt);
+}
+
+static void fdt_put_chosen(blob_t *dt, blob_t *strings, const char *cmdline,
+    uint32_t initrd_start, uint32_t initrd_end) {
+  if (cmdline)
+    fdt_put_prop(dt, strings, "bootargs", cmdline, strlen(cmdline) + 1);
+  if (initrd_end > initrd_start) {
+    uint32_t start = htonl(initrd_start), end = htonl(initrd_end);
+    fdt_put_prop(dt, strings, "linux,initrd-start", &start, 4);
+    fdt_put_prop(dt, strings, "linux,initrd-end", &end, 4);
+  }
+}
+
+/* a property of /chosen that fdt_put_chosen() replaces */
+static bool fdt_is_replaced(const char *name, const char *cmdline,
+    uint32_t initrd_start, uint32_t initrd_end) {
+  if (cmdline && strcmp(name, "bootargs") == 0) return true;
+  return initrd_end > initrd_start &&
+         (strcmp(name, "linux,initrd-start") == 0 ||
+             strcmp(name, "linux,initrd-end") == 0);
+}
+
+/* a copy of the blob whose /chosen has the command line and
+ * the initrd (physical addresses) given, in place of the
+ * old values, the others are kept */
+static blob_t fdt_set_chosen(const void *fdt, const char *cmdline,
+    uint32_t initrd_start, uint32_t initrd_end) {
+  const fdt_header_t *h = fdt;
+  Assert(ntohl(h->magic) == FDT_MAGIC, "%s is not a device tree", dtb_file);
+  Assert(ntohl(h->version) >= 17, "device tree version %d is too old",
+      ntohl(h->version));
+
+  const uint32_t *tok = fdt + ntohl(h->off_dt_struct);
+  const char *old_strings = fdt + ntohl(h->off_dt_strings);
+  blob_t dt = {0}, strings = {0};
+  blob_put(&strings, old_strings, ntohl(h->size_dt_strings));
+
+  int depth = 0;
+  bool in_chosen = false, has_chosen = false;
+  for (bool end = false; !end;) {
+    const uint32_t *next = tok + 1;
+    switch (ntohl(*tok)) {
+    case FDT_BEGIN_NODE: {
+      const char *name = (const char *)next;
+      next += (strlen(name) + 4) / 4;
+      if (++depth == 2 && strcmp(name, "chosen") == 0)
+        in_chosen = has_chosen = true;
+      break;
+    }
+    case FDT_PROP: {
+      uint32_t len = ntohl(next[0]);
+      const char *name = old_strings + ntohl(next[1]);
+      next += 2 + (len + 3) / 4;
+      if (in_chosen &&
+          fdt_is_replaced(name, cmdline, initrd_start, initrd_end)) {
+        tok = next;
+        continue;
+      }
+      break;
+    }
+    case FDT_END_NODE:
+      if (depth == 2 && in_chosen) {
+        fdt_put_chosen(&dt, &strings, cmdline, initrd_start, initrd_end);
+        in_chosen = false;
+      } else if (depth == 1 && !has_chosen) {
+        blob_put32(&dt, FDT_BEGIN_NODE);
+        blob_put(&dt, "chosen", 7);
+        blob_align(&dt);
+        fdt_put_chosen(&dt, &strings, cmdline, initrd_start, initrd_end);
+        blob_put32(&dt, FDT_END_NODE);
+      }
+      depth--;
+      break;
+    case FDT_NOP: break;
+    case FDT_END: end = true; break;
+    default: panic("bad token %08x in %s", ntohl(*tok), dtb_file);
+    }
+    blob_put(&dt, tok, (next - tok) * 4);
+    tok = next;
+  }
+
+  /* header, reservations, structure, strings */
+  const uint64_t *rsv = fdt + ntohl(h->off_mem_rsvmap);
+  uint32_t rsv_size = 16;
+  while (rsv[rsv_size / 8 - 2] || rsv[rsv_size / 8 - 1]) rsv_size += 16;
+
+  fdt_header_t nh = *h;
+  nh.off_mem_rsvmap = htonl(sizeof(nh));
+  nh.off_dt_struct = htonl(sizeof(nh) + rsv_size);
+  nh.size_dt_struct = htonl(dt.len);
+  nh.off_dt_strings = htonl(sizeof(nh) + rsv_size + dt.len);
+  nh.size_dt_strings = htonl(strings.len);
+  nh.totalsize = htonl(sizeof(nh) + rsv_size + dt.len + strings.len);
+
+  blob_t out = {0};
+  blob_put(&out, &nh, sizeof(nh));
+  blob_put(&out, rsv, rsv_size);
+  blob_put(&out, dt.p, dt.len);
+  blob_put(&out, strings.p, strings.len);
+  free(dt.p);
+  free(strings.p);
+  return out;
+}
+
+/* end of the kernel in physical memory */
+static uint32_t kernel_end() {
+  const mapped_file_t *file = map_file(kernel_file);
+  const Elf32_Ehdr *elf = file->p;
+  uint32_t end = 0;
+  for (int i = 0; i < elf->e_phnum; i++) {
+    const Elf32_Phdr *ph = file->p + i * elf->e_phentsize + elf->e_phoff;
+    if (ph->p_type != PT_LOAD) continue;
+    uint32_t seg_end = ioremap(ph->p_vaddr) + ph->p_memsz;
+    if (seg_end > end) end = seg_end;
+  }
+  return end;
+}
+
+/* take len bytes below *top, aligned down to align */
+static uint32_t ddr_take(uint32_t *top, uint32_t len, uint32_t align) {
+  uint32_t end = kernel_end();
+  Assert(*top >= end && *top - end >= len + align,
+      "no room in DDR above the kernel");
+  *top = (*top - len) & ~(align - 1);
+  return *top;
+}
+
+void linux_boot() {
+  device_t *ddr = find_device(CONFIG_DDR_BASE);
+  Assert(ddr && ddr->map, "no DDR for the kernel");
+
+  elf_file = kernel_file;
+  load_elf();
+
+  uint32_t top = CONFIG_DDR_BASE + ddr->size;
+  uint32_t initrd_start = 0, initrd_end = 0;
+  if (initrd_file) {
+    const mapped_file_t *initrd = map_file(initrd_file);
+    Assert(initrd, "initrd '%s' cannot be opened for read", initrd_file);
+    initrd_start = ddr_take(&top, initrd->size, 4096);
+    initrd_end = initrd_start + initrd->size;
+    void *host = vaddr_map(KSEG0(initrd_start), initrd->size);
+    load_file_data(host, initrd, 0, initrd->size);
+  }
+
+  uint32_t args[4];
+  if (dtb_file) {
+    const mapped_file_t *dtb = map_file(dtb_file);
+    Assert(dtb, "device tree '%s' cannot be opened for read", dtb_file);
+    blob_t fdt =
+        fdt_set_chosen(dtb->p, kernel_cmdline, initrd_start, initrd_end);
+    uint32_t addr = ddr_take(&top, fdt.len, 8);
+    memcpy(vaddr_map(KSEG0(addr), fdt.len), fdt.p, fdt.len);
+    free(fdt.p);
+
+    args[0] = -2;
+    args[1] = KSEG0(addr);
+    args[2] = args[3] = 0;
+  } else {
+    const char *append = kernel_cmdline ? kernel_cmdline : "";
+    int len = strlen(append) + 48;
+    uint32_t str = ddr_take(&top, len, 4);
+    char *cmdline = vaddr_map(KSEG0(str), len);
+    if (initrd_file)
+      snprintf(cmdline, len, "%s rd_start=0x%08x rd_size=%u", append,
+          KSEG0(initrd_start), initrd_end - initrd_start);
+    else
+      snprintf(cmdline, len, "%s", append);
+
+    /* argv[0] is skipped by the kernel */
+    uint32_t vec[] = {KSEG0(str), KSEG0(str), 0};
+    uint32_t argv = ddr_take(&top, sizeof(vec), 4);
+    memcpy(vaddr_map(KSEG0(argv), sizeof(vec)), vec, sizeof(vec));
+
+    args[0] = 2;
+    args[1] = KSEG0(argv);
+    args[2] = KSEG0(argv + 8); /* an empty envp */
+    args[3] = ddr->size;
+  }
+
+  Log("boot %s at %08x, a0-a3 %08x %08x %08x %08x\n", kernel_file, elf_entry,
+      args[0], args[1], args[2], args[3]);
+  load_rom_args(elf_entry, args);
+}
+
+#endif
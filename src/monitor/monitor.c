@@ -2,16 +2,34 @@
 #include <getopt.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
+#include "aot.h"
 #include "device.h"
 #include "memory.h"
 #include "monitor.h"
 #include "utils.h"
 
 const char *flash_file = NULL;
+#if CONFIG_SHARED_RAM
+const char *shared_ram_name = NULL;
+#endif
+#if CONFIG_LINUX_BOOT
+const char *kernel_file = NULL;
+const char *initrd_file = NULL;
+const char *dtb_file = NULL;
+const char *kernel_cmdline = NULL;
+void linux_boot();
+#endif
 const char *elf_file = NULL;
 const char *symbol_file = NULL;
 static char *img_file = NULL;
+#if CONFIG_AOT
+static const char *aot_file = NULL;
+#endif
+/* --block-data is applied once the devices are realized */
+static const char *block_data_opts[16];
+static int nr_block_data_opts = 0;
 // static char *kernel_img = NULL;
 
 vaddr_t elf_entry = CPU_INIT_PC;
@@ -28,45 +46,88 @@ void load_rom(uint32_t entry) {
   p[3] = 0x00000000;                    // nop
 }
 
+/* the same with a0-a3 set first */
+void load_rom_args(uint32_t entry, const uint32_t args[4]) {
+  uint32_t *p = vaddr_map(CPU_INIT_PC, 48);
+  assert(p);
+  for (int i = 0; i < 4; i++) {
+    uint32_t rt = R_a0 + i;
+    *p++ = 0x3c000000 | (rt << 16) | (args[i] >> 16); // lui ai, %hi
+    *p++ = 0x34000000 | (rt << 21) | (rt << 16) |
+           (args[i] & 0xFFFF); // ori ai, ai, %lo
+  }
+  *p++ = 0x3c080000 | (entry >> 16);    // lui t0, %hi(entry)
+  *p++ = 0x35080000 | (entry & 0xFFFF); // ori t0, t0, %lo(entry)
+  *p++ = 0x01000008;                    // jr t0
+  *p++ = 0x00000000;                    // nop
+}
+
+/* copy len bytes of file at off to guest ram at host, the
+ * whole host pages in between are mapped copy-on-write from
+ * the file when both sit at the same offset in a page */
+void load_file_data(
+    void *host, const mapped_file_t *file, size_t off, size_t len) {
+  uint8_t *dst = host;
+  const uint8_t *src = file->p + off;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t head = -(uintptr_t)dst & (page - 1);
+  bool cow = ((uintptr_t)dst & (page - 1)) == (off & (page - 1));
+#if CONFIG_SHARED_RAM
+  /* a private mapping would hide it from the shm object */
+  if (shared_ram_name) cow = false;
+#endif
+  /* a small page can not be mapped into a huge one */
+  if (guest_ram_hugetlb) cow = false;
+  if (cow && len >= head + page) {
+    size_t body = (len - head) & ~(page - 1);
+    memcpy(dst, src, head);
+    void *p = mmap(dst + head, body, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_FIXED, file->fd, off + head);
+    Assert(p != MAP_FAILED, "cannot map %zu bytes of the file", body);
+    dst += head + body;
+    src += head + body;
+    len -= head + body;
+  }
+  memcpy(dst, src, len);
+}
+
 void load_elf() {
   Assert(elf_file, "Need an elf file");
 
   /* set symbol file to elf_file */
   const uint32_t elf_magic = 0x464c457f;
 
-  void *buf = read_file(elf_file);
-  Assert(buf, "elf file '%s' cannot be opened for read\n", elf_file);
+  const mapped_file_t *file = map_file(elf_file);
+  Assert(file, "elf file '%s' cannot be opened for read\n", elf_file);
+  const void *buf = file->p;
 
-  Elf32_Ehdr *elf = buf;
+  const Elf32_Ehdr *elf = buf;
 
   elf_entry = elf->e_entry;
 
-  uint32_t *p_magic = buf;
+  const uint32_t *p_magic = buf;
   assert(*p_magic == elf_magic);
 
   for (int i = 0; i < elf->e_phnum; i++) {
-    Elf32_Phdr *ph = (void *)buf + i * elf->e_phentsize + elf->e_phoff;
+    const Elf32_Phdr *ph = buf + i * elf->e_phentsize + elf->e_phoff;
     if (ph->p_type != PT_LOAD) { continue; }
 
     void *ptr = vaddr_map(ph->p_vaddr, ph->p_memsz);
-    memcpy(ptr, buf + ph->p_offset, ph->p_filesz);
+    load_file_data(ptr, file, ph->p_offset, ph->p_filesz);
     memset(ptr + ph->p_filesz, 0, ph->p_memsz - ph->p_filesz);
   }
 
   if (elf->e_entry != CPU_INIT_PC) load_rom(elf->e_entry);
-
-  free(buf);
 }
 
 static inline void load_image(const char *img, vaddr_t vaddr) {
   Assert(img, "Need an image file");
   Log("The image is %s\n", img);
 
-  size_t size = get_file_size(img);
-  void *buf = read_file(img);
-  void *ptr = vaddr_map(vaddr, size);
-  memcpy(ptr, buf, size);
-  free(buf);
+  const mapped_file_t *file = map_file(img);
+  Assert(file, "image '%s' cannot be opened for read\n", img);
+  void *ptr = vaddr_map(vaddr, file->size);
+  load_file_data(ptr, file, 0, file->size);
 }
 
 static inline void assume_elf_file() {
@@ -83,6 +144,15 @@ enum {
   OPT_FLASH,
   OPT_BLOCK_DATA,
   OPT_FIFO_DATA,
+  OPT_EXEC,
+  OPT_AOT,
+  OPT_AOT_EMIT,
+  OPT_DDR_SIZE,
+  OPT_SHARED_RAM,
+  OPT_KERNEL,
+  OPT_INITRD,
+  OPT_DTB,
+  OPT_APPEND,
 };
 
 const struct option long_options[] = {
@@ -97,6 +167,25 @@ const struct option long_options[] = {
     {"flash", 1, NULL, OPT_FLASH},
     {"block-data", 1, NULL, OPT_BLOCK_DATA},
     {"fifo-data", 1, NULL, OPT_FIFO_DATA},
+#if CONFIG_EXEC_VARIANTS
+    {"exec", 1, NULL, OPT_EXEC},
+#endif
+#if CONFIG_DDR
+    {"ddr-size", 1, NULL, OPT_DDR_SIZE},
+#endif
+#if CONFIG_SHARED_RAM
+    {"shared-ram", 1, NULL, OPT_SHARED_RAM},
+#endif
+#if CONFIG_LINUX_BOOT
+    {"kernel", 1, NULL, OPT_KERNEL},
+    {"initrd", 1, NULL, OPT_INITRD},
+    {"dtb", 1, NULL, OPT_DTB},
+    {"append", 1, NULL, OPT_APPEND},
+#endif
+#if CONFIG_AOT
+    {"aot", 1, NULL, OPT_AOT},
+    {"aot-emit", 1, NULL, OPT_AOT_EMIT},
+#endif
     {NULL, 0, NULL, 0},
 };
 
@@ -112,6 +201,37 @@ static void print_help(const char *file) {
   -s, --symbol=FILE          file to provide symbols, default elf\n\
   --fifo-data dev:FILE       initialize fifo dev data with FILE\n\
   --block-data dev:addr:FILE initialize block dev data with FILE\n\
+"
+#if CONFIG_EXEC_VARIANTS
+      "\
+  --exec=VARIANT             run the fast, trace, profile or check cpu_exec\n\
+"
+#endif
+#if CONFIG_DDR
+      "\
+  --ddr-size=SIZE            size of DDR up to 512M, with a K or M suffix\n\
+"
+#endif
+#if CONFIG_SHARED_RAM
+      "\
+  --shared-ram=NAME          keep guest ram in the shm object /dev/shm/NAME\n\
+"
+#endif
+#if CONFIG_LINUX_BOOT
+      "\
+  --kernel=FILE              boot this vmlinux directly, without u-boot\n\
+  --initrd=FILE              hand this initrd to the kernel\n\
+  --dtb=FILE                 hand this device tree to the kernel\n\
+  --append=CMDLINE           kernel command line\n\
+"
+#endif
+#if CONFIG_AOT
+      "\
+  --aot=FILE                 run code translated by --aot-emit\n\
+  --aot-emit=FILE            translate the elf to C in FILE and exit\n\
+"
+#endif
+      "\
   \n\
   -h, --help                 print program help info\n\
 \n\
@@ -125,10 +245,9 @@ void parse_fifo_data_option(const char *optarg) {
     if (optarg[len] != ':' || !head->set_fifo_data) continue;
 
     const char *file = &optarg[len + 1];
-    int filesz = get_file_size(file);
-    void *buf = read_file(file);
-    head->set_fifo_data(buf, filesz);
-    free(buf);
+    const mapped_file_t *data = map_file(file);
+    if (!data) panic("file %s not found\n", file);
+    head->set_fifo_data(data->p, data->size);
     return;
   }
 
@@ -160,13 +279,15 @@ void parse_block_data_option(const char *optarg) {
 
     if (file_s[0] == ':') {
       const char *file = &file_s[1];
-      int filesz = get_file_size(file);
-      void *buf = read_file(file);
-      if (!buf) panic("file %s not found\n", file);
-      if (head->size <= addr || head->size <= addr + filesz)
+      const mapped_file_t *data = map_file(file);
+      if (!data) panic("file %s not found\n", file);
+      if (head->size <= addr || head->size <= addr + data->size)
         panic("addr %08x in option %s is out of device bound\n", addr, optarg);
-      head->set_block_data(addr, buf, filesz);
-      free(buf);
+      if (head->map)
+        load_file_data(head->map(addr, data->size), data, 0, data->size);
+      else
+        head->set_block_data(addr, data->p, data->size);
+      invalidate_decode_range(head->start + addr, data->size);
     } else {
       panic("file not specified in %s\n", optarg);
     }
@@ -180,7 +301,31 @@ void parse_block_data_option(const char *optarg) {
   free(dup_s);
 }
 
+#if CONFIG_DDR
+/* a multiple of 4 KB up to 512 MB, like 64M */
+static uint32_t parse_size_option(const char *optarg) {
+  char *end = NULL;
+  uint64_t size = strtoull(optarg, &end, 0);
+  int shift = 0;
+  switch (*end) {
+  case 'K': shift = 10; break;
+  case 'M': shift = 20; break;
+  }
+  if (shift) end++;
+  if (*end != '\0' || size == 0 || size > (0x20000000ull >> shift) ||
+      ((size << shift) & 0xFFF))
+    panic("invalid size '%s'\n", optarg);
+  return size << shift;
+}
+#endif
+
 void parse_args(int argc, char *argv[]) {
+#if CONFIG_EXEC_VARIANTS
+  const char *exec_variant = NULL;
+#endif
+#if CONFIG_AOT
+  const char *aot_emit_file = NULL;
+#endif
   int o;
   while (
       (o = getopt_long(argc, argv, "-bcde:i:s:h", long_options, NULL)) != -1) {
@@ -202,22 +347,77 @@ void parse_args(int argc, char *argv[]) {
         img_file = optarg;
       break;
     case OPT_FLASH: flash_file = optarg; break;
-    case OPT_BLOCK_DATA: parse_block_data_option(optarg); break;
+    case OPT_BLOCK_DATA:
+      if (nr_block_data_opts == sizeof(block_data_opts) / sizeof(char *))
+        panic("too many --block-data\n");
+      block_data_opts[nr_block_data_opts++] = optarg;
+      break;
     case OPT_FIFO_DATA: parse_fifo_data_option(optarg); break;
+#if CONFIG_EXEC_VARIANTS
+    case OPT_EXEC: exec_variant = optarg; break;
+#endif
+#if CONFIG_DDR
+    case OPT_DDR_SIZE: ddr_set_size(parse_size_option(optarg)); break;
+#endif
+#if CONFIG_SHARED_RAM
+    case OPT_SHARED_RAM: shared_ram_name = optarg; break;
+#endif
+#if CONFIG_LINUX_BOOT
+    case OPT_KERNEL: kernel_file = optarg; break;
+    case OPT_INITRD: initrd_file = optarg; break;
+    case OPT_DTB: dtb_file = optarg; break;
+    case OPT_APPEND: kernel_cmdline = optarg; break;
+#endif
+#if CONFIG_AOT
+    case OPT_AOT: aot_file = optarg; break;
+    case OPT_AOT_EMIT: aot_emit_file = optarg; break;
+#endif
     case 'h':
     default: print_help(argv[0]); exit(0);
     }
   }
 
+#if CONFIG_LINUX_BOOT
+  if (kernel_file && !symbol_file) symbol_file = kernel_file;
+#endif
   if (!symbol_file) symbol_file = elf_file;
+
+#if CONFIG_AOT
+  if (aot_emit_file) {
+    aot_translate(elf_file, aot_emit_file);
+    exit(0);
+  }
+#endif
+
+#if CONFIG_EXEC_VARIANTS
+  if (exec_variant) {
+    if (!cpu_set_exec_variant(exec_variant))
+      panic("no cpu_exec variant '%s'\n", exec_variant);
+  } else
+#endif
+  if (work_mode == MODE_LOG) {
+    /* commits are printed by the traced cpu_exec */
+    cpu_set_exec_variant("trace");
+  }
 }
 
-static void gdb_sigint_handler(int sig) { nemu_state = NEMU_STOP; }
+static void gdb_sigint_handler(int sig) {
+  nemu_state = NEMU_STOP;
+  cpu_kick();
+}
 
 static void batch_sigint_handler(int sig) { nemu_exit(); }
 
 work_mode_t init_monitor(void) {
+  for (int i = 0; i < nr_block_data_opts; i++)
+    parse_block_data_option(block_data_opts[i]);
+
   /* Load the image to memory. */
+#if CONFIG_LINUX_BOOT
+  if (kernel_file) {
+    linux_boot();
+  } else
+#endif
   if (elf_file) {
     load_elf();
   } else {
@@ -226,6 +426,10 @@ work_mode_t init_monitor(void) {
 
   if (symbol_file) load_elf_symtab(symbol_file);
 
+#if CONFIG_AOT
+  if (aot_file) aot_load(aot_file);
+#endif
+
   if (!(work_mode & MODE_BATCH))
     signal(SIGINT, gdb_sigint_handler);
   else
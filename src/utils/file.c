@@ -1,10 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "utils.h"
+
 size_t get_file_size(const char *img_file) {
   struct stat file_status;
   lstat(img_file, &file_status);
@@ -33,6 +37,43 @@ void *read_file(const char *filename) {
   return buf;
 }
 
+/* the elf is mapped by its loader, the symbol table and
+ * the kernel check, all of them share one mapping, callers
+ * keep the pointer so entries never move nor go away */
+typedef struct mapped_file_entry {
+  struct mapped_file_entry *next;
+  char *path;
+  mapped_file_t file;
+} mapped_file_entry_t;
+
+static mapped_file_entry_t *mapped_files;
+
+const mapped_file_t *map_file(const char *filename) {
+  for (mapped_file_entry_t *e = mapped_files; e; e = e->next) {
+    if (strcmp(e->path, filename) == 0) return &e->file;
+  }
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  mapped_file_entry_t *e = malloc(sizeof(*e));
+  e->path = strdup(filename);
+  e->file = (mapped_file_t){.p = p, .size = st.st_size, .fd = fd};
+  e->next = mapped_files;
+  mapped_files = e;
+  return &e->file;
+}
+
 ssize_t write_s(int fd, const void *buf, size_t count) {
   size_t off = 0;
   while (off < count) {
@@ -150,6 +150,19 @@ char *gdb_xfer_handler(char *args) {
   }
 }
 
+/* monitor exec fast|trace|profile|check */
+char *gdb_monitor_command(char *hex) {
+  char cmd[64];
+  int len = 0;
+  for (; hex[0] && hex[1] && len < sizeof(cmd) - 1; hex += 2)
+    cmd[len++] = gdb_decode_hex(hex[0], hex[1]);
+  cmd[len] = '\0';
+
+  if (strncmp(cmd, "exec ", 5) == 0)
+    return cpu_set_exec_variant(cmd + 5) ? "OK" : "E01";
+  return NULL;
+}
+
 char *gdb_general_query(char *args, int arglen) {
   char *kind = strtok(args, ":");
   if (strcmp(kind, "Supported") == 0) {
@@ -168,6 +181,8 @@ char *gdb_general_query(char *args, int arglen) {
     return "OK";
   } else if (strcmp(kind, "TStatus") == 0) {
     return "";
+  } else if (strncmp(kind, "Rcmd,", 5) == 0) {
+    return gdb_monitor_command(kind + 5);
   } else {
     return NULL;
   }